@@ -0,0 +1,36 @@
+#ifndef __ALIGNEDALLOC_HH__
+#define __ALIGNEDALLOC_HH__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Alignment suitable for the widest vector loads used by the kernels.
+#define ALIGNED_ALLOC_ALIGN 64
+
+static inline void *
+aligned_malloc (size_t size)
+{
+  void *ptr = NULL;
+  if (size == 0)
+    return NULL;
+#ifdef _WIN32
+  ptr = _aligned_malloc(size, ALIGNED_ALLOC_ALIGN);
+#else
+  if (posix_memalign(&ptr, ALIGNED_ALLOC_ALIGN, size) != 0)
+    ptr = NULL;
+#endif
+  return ptr;
+}
+
+static inline void
+aligned_free (void *ptr)
+{
+#ifdef _WIN32
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+
+#endif // __ALIGNEDALLOC_HH__
@@ -0,0 +1,73 @@
+#ifndef __BOUNDEDQUEUE_HH__
+#define __BOUNDEDQUEUE_HH__
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// A first in first out queue between threads that holds at most depth
+// items: push() waits while it is full and pop() while it is empty. Once
+// closed, pop() drains what is left and then fails, and push() fails.
+template <class T>
+class BoundedQueue
+{
+public:
+  BoundedQueue(size_t depth) : depth(depth > 0 ? depth : 1), closed(false) {};
+
+  // Append item, waiting for room. Returns false if the queue is closed,
+  // item is then left as it was.
+  bool push(T&& item)
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    notFull.wait(guard, [this] { return closed || items.size() < depth; });
+    if (closed)
+      return false;
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+    return true;
+  };
+
+  // Take the first item, waiting for one. Returns false once the queue is
+  // closed and empty.
+  bool pop(T& item)
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    notEmpty.wait(guard, [this] { return closed || !items.empty(); });
+    if (items.empty())
+      return false;
+    item = std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+  };
+
+  // Items waiting now.
+  size_t size()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    return items.size();
+  };
+
+  // No more items; wakes everyone waiting.
+  void close()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    closed = true;
+    notFull.notify_all();
+    notEmpty.notify_all();
+  };
+
+private:
+  BoundedQueue(const BoundedQueue&);
+  BoundedQueue& operator=(const BoundedQueue&);
+
+  size_t                  depth;
+  bool                    closed;
+  std::deque<T>           items;
+  std::mutex              lock;
+  std::condition_variable notFull, notEmpty;
+};
+
+#endif // __BOUNDEDQUEUE_HH__
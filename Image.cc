@@ -1,127 +1,278 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
 #include <string>
-#include <math.h>
+#include <utility>
 
 #include "Image.hh"
+#include "ImageAllocator.hh"
+
+// Rows are padded so that each of them starts on this boundary.
+#define ROW_ALIGN 32
 
-// Only 8 and 16 bpc supported
+// 8, 16 bpc integer and 32 bpc float supported
 Image::Image (int32_t width, int32_t height, int8_t num_comp, int8_t bpc)
 {
+  data  = NULL;
+  owner = false;
+  reset(width, height, num_comp, bpc);
+}
+
+Image::Image (int32_t width, int32_t height, int8_t nComps, int8_t bpc,
+              const std::string& raster)
+{
+  data  = NULL;
+  owner = false;
+  reset(width, height, nComps, bpc, raster);
+}
+
+Image::Image (int32_t width, int32_t height, int8_t nComps, int8_t bpc,
+              uint8_t *data, size_t stride)
+{
+  this->data = NULL;
+  owner = false;
+  reset(width, height, nComps, bpc, data, stride);
+}
+
+Image::Image (const Image& image)
+{
+  data  = NULL;
+  owner = false;
+  *this = image;
+}
+
+Image::Image (Image&& image)
+{
+  data  = NULL;
+  owner = false;
+  *this = std::move(image);
+}
+
+Image::~Image ()
+{
+  release();
+}
+
+Image&
+Image::operator= (const Image& image)
+{
+  if (this != &image) {
+    reset(image.width, image.height, image.nComps, image.bpc);
+    if (data && stride == image.stride)
+      memcpy(data, image.data, stride * height);
+    else if (data) {
+      for (int32_t j = 0; j < height; j++)
+        memcpy(getRow(j), image.getRow(j), getRowBytes());
+    }
+  }
+  return *this;
+}
+
+Image&
+Image::operator= (Image&& image)
+{
+  if (this != &image) {
+    release();
+    width  = image.width;
+    height = image.height;
+    nComps = image.nComps;
+    bpc    = image.bpc;
+    stride = image.stride;
+    data   = image.data;
+    owner  = image.owner;
+    allocator = image.allocator;
+    image.data   = NULL;
+    image.width  = image.height = 0;
+    image.stride = 0;
+  }
+  return *this;
+}
+
+void
+Image::reset (int32_t width, int32_t height, int8_t nComps, int8_t bpc)
+{
+  release();
   this->width  = width;
   this->height = height;
-  this->nComps = num_comp;
+  this->nComps = nComps;
   this->bpc    = bpc;
-
-  data = new Color[width*height];
+  allocate();
 }
 
-Image::Image (int32_t width, int32_t height, int8_t nComps, int8_t bpc,
-              const std::string& raster)
+void
+Image::reset (int32_t width, int32_t height, int8_t nComps, int8_t bpc,
+              uint8_t *data, size_t stride)
 {
+  release();
   this->width  = width;
   this->height = height;
   this->nComps = nComps;
   this->bpc    = bpc;
+  this->stride = stride;
+  this->data   = data;
+  owner = false;
+}
 
-  data = data_from_string(raster, width, height, nComps, bpc);
+void
+Image::allocate ()
+{
+  size_t rowbytes = getRowBytes();
+  stride = (rowbytes + ROW_ALIGN - 1) / ROW_ALIGN * ROW_ALIGN;
+  allocator = ImageAllocator::getDefault();
+  data   = static_cast<uint8_t *>(allocator->allocate(stride * height));
+  // Fail as new did before allocators, rather than hand out NULL rows.
+  if (!data && stride * height > 0)
+    throw std::bad_alloc();
+  owner  = true;
 }
 
-Image::~Image ()
+void
+Image::release ()
 {
-  delete data;
+  if (owner && data)
+    allocator->release(data, stride * height);
+  data = NULL;
 }
 
-Color *
-Image::data_from_string (const std::string raster,
-                         int32_t width, int32_t height,
-                         int8_t nComps, int8_t bpc)
+void
+Image::data_from_string (const std::string& raster)
 {
-  Color *data = new Color[width*height];
+  size_t rowbytes = getRowBytes();
 
-  size_t expected = width * height * nComps * (bpc / 8);
-  std::string str = (raster.size() < expected) ?
-      raster + std::string(expected - raster.size(), 0) : raster;
-  switch (bpc) {
-  case 8:
-    for (int32_t i = 0; i < width * height; i++) {
-      Color   pixel;
-      int32_t pos = nComps * i;
-      for (int c = 0; c < nComps; c++)
-        pixel.v[c] = round(65535 * ((uint8_t) str.at(pos+c) / 255.0));
-      data[i] = pixel;
-    }
-    break;
-  case 16:
-    for (int32_t i = 0; i < width * height; i++) {
-      Color   pixel;
-      int32_t pos = 2 * nComps * i;
-      for (int c = 0; c < nComps; c++)
-        pixel.v[c] = ((uint8_t) str.at(pos+2*c)) * 256  +
-                                      (uint8_t) str.at(pos+2*c+1);
-      data[i] = pixel;
+  for (int32_t j = 0; j < height; j++) {
+    uint8_t *row = getRow(j);
+    size_t   pos = j * rowbytes;
+    size_t   len = pos < raster.size() ? raster.size() - pos : 0;
+    if (len > rowbytes)
+      len = rowbytes;
+    switch (bpc) {
+    case 16:
+      {
+        uint16_t *p = reinterpret_cast<uint16_t *>(row);
+        for (size_t i = 0; i < len / 2; i++)
+          p[i] = ((uint8_t) raster[pos+2*i]) * 256 +
+                  (uint8_t) raster[pos+2*i+1];
+        len &= ~((size_t) 1);
+      }
+      break;
+    default:
+      memcpy(row, raster.data() + pos, len);
+      break;
     }
-    break;
+    // Missing data is padded with zero.
+    memset(row + len, 0, rowbytes - len);
   }
+}
+
+Image
+Image::getRegion (int32_t x, int32_t y, int32_t width, int32_t height) const
+{
+  Image region(width, height, nComps, bpc);
 
-  return  data;
+  for (int32_t j = 0; j < height; j++)
+    memcpy(region.getRow(j), getRow(y + j) + x * getPixelSize(),
+           region.getRowBytes());
+  return region;
 }
 
 // Periodic boundary...
-Color
-Image::getPixel (int32_t x, int32_t y) const
+static inline int32_t
+wrap (int32_t x, int32_t size)
 {
   if (x < 0) {
     while (x < 0)
-      x += width;
-  } else if (x >= width) {
-    while (x >= width)
-      x -= width;
+      x += size;
+  } else if (x >= size) {
+    while (x >= size)
+      x -= size;
   }
-  if (y < 0) {
-    while (y < 0)
-      y += height;
-  } else if (y >= height) {
-    while (y >= height)
-      y -= height;
+  return x;
+}
+
+Color
+Image::getPixel (int32_t x, int32_t y) const
+{
+  Color pixel;
+
+  x = wrap(x, width);
+  y = wrap(y, height);
+  pixel.n = nComps;
+  switch (bpc) {
+  case 8:
+    {
+      const uint8_t *p = getRowAs<uint8_t>(y) + x * nComps;
+      for (int c = 0; c < nComps; c++)
+        pixel.v[c] = p[c] * 257;
+    }
+    break;
+  case 16:
+    {
+      const uint16_t *p = getRowAs<uint16_t>(y) + x * nComps;
+      for (int c = 0; c < nComps; c++)
+        pixel.v[c] = p[c];
+    }
+    break;
+  case 32:
+    {
+      const float *p = getRowAs<float>(y) + x * nComps;
+      for (int c = 0; c < nComps; c++) {
+        float v = p[c] < 0.0f ? 0.0f : p[c] > 1.0f ? 1.0f : p[c];
+        pixel.v[c] = (uint16_t) (v * 65535.0f + 0.5f);
+      }
+    }
+    break;
   }
-  return data[y * width + x];
+  return pixel;
 }
 
 void
 Image::putPixel (int32_t x, int32_t y, Color value)
 {
-  if (x < 0) {
-    while (x < 0)
-      x += width;
-  } else if (x >= width) {
-    while (x >= width)
-      x -= width;
-  }
-  if (y < 0) {
-    while (y < 0)
-      y += height;
-  } else if (y >= height) {
-    while (y >= height)
-      y -= height;
+  x = wrap(x, width);
+  y = wrap(y, height);
+  switch (bpc) {
+  case 8:
+    {
+      uint8_t *p = getRowAs<uint8_t>(y) + x * nComps;
+      for (int c = 0; c < nComps; c++)
+        p[c] = (value.v[c] + 128) / 257;
+    }
+    break;
+  case 16:
+    {
+      uint16_t *p = getRowAs<uint16_t>(y) + x * nComps;
+      for (int c = 0; c < nComps; c++)
+        p[c] = value.v[c];
+    }
+    break;
+  case 32:
+    {
+      float *p = getRowAs<float>(y) + x * nComps;
+      for (int c = 0; c < nComps; c++)
+        p[c] = value.v[c] / 65535.0f;
+    }
+    break;
   }
-  data[y * width + x] = value;
 }
 
 std::string
 Image::getPixelBytes () const
 {
-  std::string bytes(width * height * nComps * (bpc / 8), 0);
+  size_t      rowbytes = getRowBytes();
+  std::string bytes(rowbytes * height, 0);
+
   for (int32_t j = 0; j < height; j++) {
-    for (int32_t i = 0; i < width; i++) {
-      Color  pixel = getPixel(i, j);
-      size_t pos   = (bpc / 8) * nComps * (j * width + i);
-      for (int c = 0; c < nComps; c++) {
-        if (bpc == 8) {
-          bytes[pos + c] = round(255 * (pixel.v[c] / 65535.0));
-        } else {
-          bytes[pos+2*c]   = (pixel.v[c] >> 8) & 0xff;
-          bytes[pos+2*c+1] =  pixel.v[c] & 0xff;
-        }
+    const uint8_t *row = getRow(j);
+    size_t         pos = j * rowbytes;
+    if (bpc == 16) {
+      const uint16_t *p = reinterpret_cast<const uint16_t *>(row);
+      for (size_t i = 0; i < rowbytes / 2; i++) {
+        bytes[pos+2*i]   = (p[i] >> 8) & 0xff;
+        bytes[pos+2*i+1] =  p[i] & 0xff;
       }
+    } else {
+      memcpy(&bytes[pos], row, rowbytes);
     }
   }
   return bytes;
@@ -1,8 +1,13 @@
 #ifndef __IMAGE_HH__
 #define __IMAGE_HH__
 
+#include <stdint.h>
+#include <stddef.h>
+
 #include <string>
 
+class ImageAllocator;
+
 class Color
 {
 public:
@@ -14,28 +19,61 @@ public:
   Color(uint16_t r, uint16_t g, uint16_t b) {
     v[0] = r; v[1] = g; v[2] = b; n = 3;
   };
-  Color(uint16_t g, uint16_t a) { v[0] = g; v[1] = a; };
+  Color(uint16_t g, uint16_t a) { v[0] = g; v[1] = a; n = 2; };
   Color(uint16_t g) { v[0] = g; n = 1; };
 
   uint16_t v[5];
   int8_t   n;
 };
 
+// Pixels are stored interleaved in the image's own sample type:
+// uint8_t for 8 bpc, uint16_t (host byte order) for 16 bpc and float for
+// 32 bpc. Float samples are nominally in the range 0.0 to 1.0.
+// Each row starts on an aligned boundary; use getStride() to step between
+// rows instead of assuming width * nComps samples per row. Pixels are
+// allocated from ImageAllocator::getDefault() at the time.
 class Image
 {
 public:
   Image(int32_t width, int32_t height, int8_t num_comp, int8_t bpc);
   Image(int32_t width, int32_t height, int8_t num_comp, int8_t bpc,
         const std::string& raster);
+  // Image on rows stride bytes apart in memory of the caller, which must
+  // outlive it. Copies of it own their pixels.
+  Image(int32_t width, int32_t height, int8_t num_comp, int8_t bpc,
+        uint8_t *data, size_t stride);
+  Image(const Image& image);
+  Image(Image&& image);
   ~Image();
 
+  Image& operator=(const Image& image);
+  Image& operator=(Image&& image);
+
   int32_t  getWidth()  const { return width; };
   int32_t  getHeight() const { return height; };
   int8_t   getNComps() const { return nComps; };
   int8_t   getBPC() const { return bpc; };
 
+  // Bytes per pixel, bytes of pixel data in a row and distance in bytes
+  // between the starts of two consecutive rows.
+  size_t   getPixelSize() const { return nComps * (bpc / 8); };
+  size_t   getRowBytes()  const { return width * getPixelSize(); };
+  size_t   getStride()    const { return stride; };
+
+  uint8_t       *getRow(int32_t y)       { return data + y * stride; };
+  const uint8_t *getRow(int32_t y) const { return data + y * stride; };
+  template <typename T> T *getRowAs(int32_t y)
+    { return reinterpret_cast<T *>(getRow(y)); };
+  template <typename T> const T *getRowAs(int32_t y) const
+    { return reinterpret_cast<const T *>(getRow(y)); };
+
+  // Copy of the width by height pixels at x, y, which must lie inside.
+  Image getRegion(int32_t x, int32_t y, int32_t width, int32_t height) const;
+
+  // Packed (no row padding) samples, 16 bpc values in big-endian order.
   std::string getPixelBytes() const;
 
+  // Compatibility layer: pixel values are converted from and to 16 bit.
   Color getPixel(int32_t x, int32_t y) const;
   void  putPixel(int32_t x, int32_t y, Color color);
 
@@ -45,27 +83,31 @@ protected:
   // within its constructor does not know required width, height, and other
   // values until they finish reading a file. Actual construction of Image
   // super class must be delayed until they finish to read input file.
+  void reset(int32_t width, int32_t height, int8_t nComps, int8_t bpc);
   void reset(int32_t width, int32_t height,
-             int8_t nComps, int8_t bpc, const std::string raster)
+             int8_t nComps, int8_t bpc, const std::string& raster)
   {
-    this->width  = width;
-    this->height = height;
-    this->nComps = nComps;
-    this->bpc    = bpc;
-    delete data;
-    data = data_from_string(raster, width, height, nComps, bpc);
+    reset(width, height, nComps, bpc);
+    data_from_string(raster);
   };
+  // Use rows stride bytes apart in memory that outlives the image.
+  void reset(int32_t width, int32_t height, int8_t nComps, int8_t bpc,
+             uint8_t *data, size_t stride);
 
 private:
-  static Color *data_from_string (const std::string raster,
-                                  int32_t width, int32_t height,
-                                  int8_t nComps, int8_t bpc);
+  void allocate();
+  void release();
+  void data_from_string(const std::string& raster);
+
   int32_t  width;
   int32_t  height;
   int8_t   nComps;
   int8_t   bpc;
+  size_t   stride;
 
-  Color *data;
+  uint8_t        *data;
+  bool            owner;     // of data
+  ImageAllocator *allocator; // of data, if owner
 };
 
 #endif // __IMAGE_HH__
@@ -0,0 +1,186 @@
+#include <stdio.h>
+
+#include <atomic>
+
+#include "AlignedAlloc.hh"
+#include "ImageAllocator.hh"
+
+// Smallest class; smaller buffers are rounded up to it.
+#define BUFFER_POOL_MIN   4096
+// Classes per power of two.
+#define BUFFER_POOL_STEPS 8
+
+namespace {
+// Straight to aligned_malloc() and aligned_free().
+class SystemAllocator : public ImageAllocator
+{
+public:
+  virtual void *allocate(size_t size) { return aligned_malloc(size); };
+  virtual void  release(void *ptr, size_t) { aligned_free(ptr); };
+};
+}
+
+static SystemAllocator               systemAllocator;
+static std::atomic<ImageAllocator *> defaultAllocator(&systemAllocator);
+
+ImageAllocator *
+ImageAllocator::getDefault ()
+{
+  return defaultAllocator;
+}
+
+void
+ImageAllocator::setDefault (ImageAllocator *allocator)
+{
+  defaultAllocator = allocator ? allocator : &systemAllocator;
+}
+
+BufferPool::BufferPool (size_t limit) :
+  limit(limit), hits(0), misses(0), resident(0), peak(0), idle(0)
+{
+}
+
+BufferPool::~BufferPool ()
+{
+  trim();
+}
+
+size_t
+BufferPool::getClassSize (size_t size)
+{
+  if (size <= BUFFER_POOL_MIN)
+    return BUFFER_POOL_MIN;
+
+  // Round up to a multiple of 1/STEPS of the power of two below size.
+  size_t octave = BUFFER_POOL_MIN;
+  while (octave <= size / 2)
+    octave *= 2;
+  size_t step = octave / BUFFER_POOL_STEPS;
+  return (size + step - 1) / step * step;
+}
+
+// The list of class size, made if there is none; lock must be held.
+BufferPool::FreeList&
+BufferPool::getList (size_t size)
+{
+  size_t i = 0;
+  while (i < lists.size() && lists[i].size < size)
+    i++;
+  if (i == lists.size() || lists[i].size != size) {
+    FreeList list;
+    list.size = size;
+    lists.insert(lists.begin() + i, list);
+  }
+  return lists[i];
+}
+
+void *
+BufferPool::allocate (size_t size)
+{
+  if (size == 0)
+    return NULL;
+  size = getClassSize(size);
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    FreeList& list = getList(size);
+    if (!list.buffers.empty()) {
+      void *ptr = list.buffers.back();
+      list.buffers.pop_back();
+      idle -= size;
+      hits++;
+      return ptr;
+    }
+    misses++;
+  }
+
+  void *ptr = aligned_malloc(size);
+  if (ptr) {
+    std::lock_guard<std::mutex> guard(lock);
+    resident += size;
+    if (peak < resident)
+      peak = resident;
+  }
+  return ptr;
+}
+
+void
+BufferPool::release (void *ptr, size_t size)
+{
+  if (!ptr)
+    return;
+  size = getClassSize(size);
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (idle + size <= limit) {
+      getList(size).buffers.push_back(ptr);
+      idle += size;
+      return;
+    }
+    resident -= size;
+  }
+  aligned_free(ptr);
+}
+
+void
+BufferPool::trim ()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  for (size_t i = 0; i < lists.size(); i++) {
+    for (size_t j = 0; j < lists[i].buffers.size(); j++)
+      aligned_free(lists[i].buffers[j]);
+    resident -= lists[i].size * lists[i].buffers.size();
+    lists[i].buffers.clear();
+  }
+  idle = 0;
+}
+
+uint64_t
+BufferPool::getHits () const
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return hits;
+}
+
+uint64_t
+BufferPool::getMisses () const
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return misses;
+}
+
+size_t
+BufferPool::getResidentBytes () const
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return resident;
+}
+
+size_t
+BufferPool::getPeakResidentBytes () const
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return peak;
+}
+
+size_t
+BufferPool::getIdleBytes () const
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return idle;
+}
+
+std::string
+BufferPool::getStatus () const
+{
+  std::lock_guard<std::mutex> guard(lock);
+  char status[256];
+  snprintf(status, sizeof(status),
+           "{\"hits\": %llu, \"misses\": %llu, \"hit_rate\": %.3f, "
+           "\"resident_bytes\": %llu, \"peak_resident_bytes\": %llu, "
+           "\"idle_bytes\": %llu}",
+           (unsigned long long) hits, (unsigned long long) misses,
+           hits + misses > 0 ? (double) hits / (hits + misses) : 0.0,
+           (unsigned long long) resident, (unsigned long long) peak,
+           (unsigned long long) idle);
+  return status;
+}
@@ -0,0 +1,85 @@
+#ifndef __IMAGEALLOCATOR_HH__
+#define __IMAGEALLOCATOR_HH__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Where Image gets its pixel buffers. Buffers are aligned to
+// ALIGNED_ALLOC_ALIGN, a cache line. An image keeps the allocator it got
+// its buffer from, so the default may be changed at any time; an
+// allocator must outlive the images it allocated.
+class ImageAllocator
+{
+public:
+  virtual ~ImageAllocator() {};
+
+  // A buffer of at least size bytes, NULL if size is 0 or there is no
+  // memory. Thread-safe.
+  virtual void *allocate(size_t size) = 0;
+  // Give back a buffer of allocate(size).
+  virtual void  release(void *ptr, size_t size) = 0;
+
+  // The allocator of new images: aligned_malloc() unless set, NULL puts
+  // that back.
+  static ImageAllocator *getDefault();
+  static void setDefault(ImageAllocator *allocator);
+};
+
+// Keeps released buffers for reuse instead of freeing them, so that the
+// images of one size after another, or the intermediate images of a
+// resampler called again and again, come back with their pages already
+// faulted in. Sizes are rounded up to classes 1/8 of a power of two
+// apart; a buffer is reused for any size of its class, the most recently
+// released first. Idle buffers are kept up to limit bytes, beyond that
+// they are freed.
+class BufferPool : public ImageAllocator
+{
+public:
+  BufferPool(size_t limit = 256 << 20);
+  ~BufferPool();
+
+  virtual void *allocate(size_t size);
+  virtual void  release(void *ptr, size_t size);
+
+  // Free the idle buffers.
+  void trim();
+
+  // Allocations served from idle buffers, and from the system.
+  uint64_t getHits() const;
+  uint64_t getMisses() const;
+  // Bytes of buffers allocated from the system and not freed, in use or
+  // idle; the most there were; and those idle.
+  size_t   getResidentBytes() const;
+  size_t   getPeakResidentBytes() const;
+  size_t   getIdleBytes() const;
+
+  // The counts above as a line of JSON.
+  std::string getStatus() const;
+
+  // Size of the class of size.
+  static size_t getClassSize(size_t size);
+
+private:
+  BufferPool(const BufferPool&);
+  BufferPool& operator=(const BufferPool&);
+
+  struct FreeList
+  {
+    size_t              size;
+    std::vector<void *> buffers;
+  };
+
+  size_t                limit;
+  mutable std::mutex    lock;
+  std::vector<FreeList> lists;   // by size
+  uint64_t              hits, misses;
+  size_t                resident, peak, idle;
+
+  FreeList& getList(size_t size);
+};
+
+#endif // __IMAGEALLOCATOR_HH__
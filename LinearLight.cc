@@ -0,0 +1,171 @@
+#include <math.h>
+#include <string.h>
+
+#include <mutex>
+
+#include "LinearLight.hh"
+#include "ResampleKernels.hh"
+
+// The encode table covers 2^-ENCODE_OCTAVES to 1.0 in pieces of
+// 2^-ENCODE_STEP_BITS of an octave, that is the float bits of a value
+// above the lowest, shifted right by ENCODE_SHIFT, are its piece. Below
+// that the curve is taken as a straight line through 0.
+#define ENCODE_OCTAVES   40
+#define ENCODE_STEP_BITS 7
+#define ENCODE_SHIFT     (23 - ENCODE_STEP_BITS)
+#define ENCODE_BASE      ((uint32_t) (127 - ENCODE_OCTAVES) << 23)
+#define ENCODE_SIZE      ((ENCODE_OCTAVES << ENCODE_STEP_BITS) + 1)
+
+LinearLight::LinearLight (double gamma) :
+  gamma(gamma), decode8(256), decode16(65536), encode(ENCODE_SIZE)
+{
+  for (int i = 0; i < 256; i++)
+    decode8[i] = (float) toLinear(i / 255.0);
+  for (int i = 0; i < 65536; i++)
+    decode16[i] = (float) toLinear(i / 65535.0);
+  for (int i = 0; i < ENCODE_SIZE; i++) {
+    uint32_t bits = ENCODE_BASE + ((uint32_t) i << ENCODE_SHIFT);
+    float    v;
+    memcpy(&v, &bits, sizeof(v));
+    encode[i] = (float) fromLinear(v);
+  }
+}
+
+double
+LinearLight::toLinear (double v) const
+{
+  if (v <= 0.0)
+    return 0.0;
+  if (v >= 1.0)
+    return 1.0;
+  if (gamma > 0.0)
+    return pow(v, gamma);
+  return v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+}
+
+double
+LinearLight::fromLinear (double v) const
+{
+  if (v <= 0.0)
+    return 0.0;
+  if (v >= 1.0)
+    return 1.0;
+  if (gamma > 0.0)
+    return pow(v, 1.0 / gamma);
+  return v <= 0.0031308 ? v * 12.92 : 1.055 * pow(v, 1.0 / 2.4) - 0.055;
+}
+
+inline float
+LinearLight::encodeSample (float v) const
+{
+  uint32_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  // Also negative values and NaN.
+  if (!(v > 0.0f))
+    return 0.0f;
+  if (v >= 1.0f)
+    return 1.0f;
+  if (bits < ENCODE_BASE)
+    return v * encode[0] * (float) (1ULL << ENCODE_OCTAVES);
+
+  uint32_t k    = bits - ENCODE_BASE;
+  uint32_t i    = k >> ENCODE_SHIFT;
+  float    frac = (k & ((1 << ENCODE_SHIFT) - 1)) *
+                  (1.0f / (1 << ENCODE_SHIFT));
+  return encode[i] + frac * (encode[i + 1] - encode[i]);
+}
+
+void
+LinearLight::decodeRow (float *out, const void *in, int32_t width,
+                        int nComps, int bpc) const
+{
+  int     alpha = nComps == 2 || nComps == 4 ? nComps - 1 : nComps;
+  int32_t n     = width * nComps;
+
+  switch (bpc) {
+  case 8:
+    {
+      const uint8_t *p = static_cast<const uint8_t *>(in);
+      for (int32_t k = 0; k < n; k++)
+        out[k] = decode8[p[k]];
+      if (alpha < nComps) {
+        for (int32_t k = alpha; k < n; k += nComps)
+          out[k] = p[k] * (1.0f / 255.0f);
+      }
+    }
+    break;
+  case 16:
+    {
+      const uint16_t *p = static_cast<const uint16_t *>(in);
+      for (int32_t k = 0; k < n; k++)
+        out[k] = decode16[p[k]];
+      if (alpha < nComps) {
+        for (int32_t k = alpha; k < n; k += nComps)
+          out[k] = p[k] * (1.0f / 65535.0f);
+      }
+    }
+    break;
+  default:
+    {
+      const float *p = static_cast<const float *>(in);
+      for (int32_t k = 0; k < n; k++)
+        out[k] = k % nComps == alpha ? p[k] : (float) toLinear(p[k]);
+    }
+    break;
+  }
+}
+
+void
+LinearLight::encodeRow (void *out, const float *in, int32_t width,
+                        int nComps, int bpc) const
+{
+  int     alpha = nComps == 2 || nComps == 4 ? nComps - 1 : nComps;
+  int32_t n     = width * nComps;
+
+  switch (bpc) {
+  case 8:
+    {
+      uint8_t *p = static_cast<uint8_t *>(out);
+      for (int32_t k = 0; k < n; k++)
+        p[k] = clampToUint8(encodeSample(in[k]) * 255.0f);
+      if (alpha < nComps) {
+        for (int32_t k = alpha; k < n; k += nComps)
+          p[k] = clampToUint8(in[k] * 255.0f);
+      }
+    }
+    break;
+  case 16:
+    {
+      uint16_t *p = static_cast<uint16_t *>(out);
+      for (int32_t k = 0; k < n; k++)
+        p[k] = clampToUint16(encodeSample(in[k]) * 65535.0f);
+      if (alpha < nComps) {
+        for (int32_t k = alpha; k < n; k += nComps)
+          p[k] = clampToUint16(in[k] * 65535.0f);
+      }
+    }
+    break;
+  default:
+    {
+      float *p = static_cast<float *>(out);
+      for (int32_t k = 0; k < n; k++)
+        p[k] = k % nComps == alpha ? in[k] : encodeSample(in[k]);
+    }
+    break;
+  }
+}
+
+std::shared_ptr<const LinearLight>
+LinearLight::get (double gamma)
+{
+  static std::mutex lock;
+  static std::vector<std::shared_ptr<const LinearLight> > curves;
+
+  std::lock_guard<std::mutex> guard(lock);
+  for (size_t i = 0; i < curves.size(); i++) {
+    if (curves[i]->getGamma() == gamma)
+      return curves[i];
+  }
+  curves.push_back(std::make_shared<const LinearLight>(gamma));
+  return curves.back();
+}
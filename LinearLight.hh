@@ -0,0 +1,44 @@
+#ifndef __LINEARLIGHT_HH__
+#define __LINEARLIGHT_HH__
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+// Transfer function of gamma encoded samples, with tables to take rows to
+// linear light and back. Decoding 8 and 16 bpc samples is a table lookup;
+// encoding interpolates a table over the bits of the float, pieces 1/128
+// of an octave wide, to within 0.1 of a 16 bpc step. Alpha, the last of 2
+// or 4 components, is linear already and only scaled.
+class LinearLight
+{
+public:
+  // The sRGB curve if gamma is 0, otherwise linear = encoded^gamma.
+  LinearLight(double gamma);
+
+  double getGamma() const { return gamma; };
+
+  // Samples of bpc bits (32 for float) to linear floats, 1.0 full scale.
+  void decodeRow(float *out, const void *in, int32_t width,
+                 int nComps, int bpc) const;
+  // Linear floats to samples of bpc bits, rounded and clamped.
+  void encodeRow(void *out, const float *in, int32_t width,
+                 int nComps, int bpc) const;
+
+  // The exact curve, 0.0 to 1.0 both ways.
+  double toLinear(double v) const;
+  double fromLinear(double v) const;
+
+  // A shared instance for gamma, the tables built on first use.
+  static std::shared_ptr<const LinearLight> get(double gamma);
+
+private:
+  double gamma;
+  std::vector<float> decode8, decode16;
+  std::vector<float> encode;  // see encodeSample() in LinearLight.cc
+
+  float encodeSample(float v) const;
+};
+
+#endif // __LINEARLIGHT_HH__
@@ -0,0 +1,379 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+
+#include "MappedImage.hh"
+
+static bool
+isBigEndian (void)
+{
+  const uint16_t one = 1;
+  return *reinterpret_cast<const uint8_t *>(&one) == 0;
+}
+
+// Copy n samples of size bytes each, reversing their byte order.
+static void
+copySwapped (uint8_t *dst, const uint8_t *src, size_t n, size_t size)
+{
+  if (size == 2) {
+    for (size_t i = 0; i < n; i++, dst += 2, src += 2) {
+      dst[0] = src[1];
+      dst[1] = src[0];
+    }
+  } else {
+    for (size_t i = 0; i < n; i++, dst += size, src += size)
+      for (size_t k = 0; k < size; k++)
+        dst[k] = src[size - 1 - k];
+  }
+}
+
+// Parse a decimal number at p, after white space and comments as in PNM
+// headers. Returns false past end.
+static bool
+parseNumber (const uint8_t *&p, const uint8_t *end, long& value)
+{
+  for (;;) {
+    while (p < end && isspace(*p))
+      p++;
+    if (p < end && *p == '#') {
+      while (p < end && *p != '\n')
+        p++;
+      continue;
+    }
+    break;
+  }
+  if (p >= end || !isdigit(*p))
+    return false;
+  value = 0;
+  while (p < end && isdigit(*p) && value < 0x7fffffff)
+    value = value * 10 + (*p++ - '0');
+  return value < 0x7fffffff;
+}
+
+// Sample size for maxval, 0 when unsupported.
+static int8_t
+bpcOf (long maxval)
+{
+  return maxval == 255 ? 8 : maxval == 65535 ? 16 : 0;
+}
+
+MappedImage::MappedImage (const std::string& filename) :
+  Image(0, 0, 1, 8)
+{
+  map = NULL;
+  size = 0;
+  isValid = false;
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    size = (size_t) st.st_size;
+    // Writable, but private, so that the pixels need not be const.
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED)
+      map = static_cast<uint8_t *>(p);
+  }
+  close(fd);
+  if (!map)
+    return;
+
+  size_t  offset = 0, stride = 0;
+  int32_t width = 0, height = 0;
+  int8_t  nComps = 0, bpc = 0;
+  bool    bigEndian = true;
+  bool    parsed = false;
+  if (size >= 2 && map[0] == 'P' && (map[1] == '5' || map[1] == '6'))
+    parsed = parsePNM(offset, width, height, nComps, bpc);
+  else if (size >= 2 && map[0] == 'P' && map[1] == '7')
+    parsed = parsePAM(offset, width, height, nComps, bpc);
+  else if (size >= 8 && memcmp(map, "RAWIMAGE", 8) == 0)
+    parsed = parseRaw(offset, width, height, nComps, bpc, stride, bigEndian);
+  if (!parsed)
+    return;
+  if (stride == 0)
+    stride = (size_t) width * nComps * (bpc / 8);
+  if (offset > size || stride > (size - offset) / height)
+    return;
+
+  // Rows are read once, front to back.
+  madvise(map, size, MADV_SEQUENTIAL);
+  madvise(map, size, MADV_WILLNEED);
+
+  size_t sample = bpc / 8;
+  if ((sample == 1 || bigEndian == isBigEndian()) &&
+      offset % sample == 0 && stride % sample == 0) {
+    reset(width, height, nComps, bpc, map + offset, stride);
+  } else {
+    reset(width, height, nComps, bpc);
+    for (int32_t y = 0; y < height; y++) {
+      const uint8_t *src = map + offset + y * stride;
+      if (bigEndian == isBigEndian())
+        memcpy(getRow(y), src, getRowBytes());
+      else
+        copySwapped(getRow(y), src, (size_t) width * nComps, sample);
+    }
+    // The pixels are all copied; the mapping is no longer needed.
+    munmap(map, this->size);
+    map = NULL;
+  }
+  isValid = true;
+}
+
+MappedImage::~MappedImage ()
+{
+  if (map)
+    munmap(map, size);
+}
+
+// "P5" or "P6", width, height and maxval, separated by white space or
+// comments, and a single white space before the samples.
+bool
+MappedImage::parsePNM (size_t& offset, int32_t& width, int32_t& height,
+                       int8_t& nComps, int8_t& bpc) const
+{
+  const uint8_t *p = map + 2, *end = map + size;
+  long w, h, maxval;
+
+  if (!parseNumber(p, end, w) || !parseNumber(p, end, h) ||
+      !parseNumber(p, end, maxval) || p >= end || !isspace(*p))
+    return false;
+  nComps = map[1] == '5' ? 1 : 3;
+  bpc    = bpcOf(maxval);
+  if (w <= 0 || h <= 0 || bpc == 0)
+    return false;
+  width  = (int32_t) w;
+  height = (int32_t) h;
+  offset = p + 1 - map;
+  return true;
+}
+
+// "P7" then lines of "KEY value" up to "ENDHDR". TUPLTYPE is not needed
+// beyond DEPTH and is ignored.
+bool
+MappedImage::parsePAM (size_t& offset, int32_t& width, int32_t& height,
+                       int8_t& nComps, int8_t& bpc) const
+{
+  const uint8_t *p = map + 2, *end = map + size;
+  long w = 0, h = 0, depth = 0, maxval = 0;
+
+  for (;;) {
+    while (p < end && isspace(*p))
+      p++;
+    const uint8_t *key = p;
+    while (p < end && !isspace(*p))
+      p++;
+    std::string name(key, p);
+    if (p >= end)
+      return false;
+    if (name == "ENDHDR") {
+      while (p < end && *p != '\n')
+        p++;
+      if (p >= end)
+        return false;
+      p++;
+      break;
+    }
+    bool ok = true;
+    if (name == "WIDTH")
+      ok = parseNumber(p, end, w);
+    else if (name == "HEIGHT")
+      ok = parseNumber(p, end, h);
+    else if (name == "DEPTH")
+      ok = parseNumber(p, end, depth);
+    else if (name == "MAXVAL")
+      ok = parseNumber(p, end, maxval);
+    else
+      while (p < end && *p != '\n')
+        p++;
+    if (!ok)
+      return false;
+  }
+  bpc = bpcOf(maxval);
+  if (w <= 0 || h <= 0 || depth < 1 || depth > 4 || bpc == 0)
+    return false;
+  width  = (int32_t) w;
+  height = (int32_t) h;
+  nComps = (int8_t) depth;
+  offset = p - map;
+  return true;
+}
+
+bool
+MappedImage::parseRaw (size_t& offset, int32_t& width, int32_t& height,
+                       int8_t& nComps, int8_t& bpc, size_t& stride,
+                       bool& bigEndian) const
+{
+  char header[RAW_HEADER_SIZE + 1];
+  char order[3];
+  long w, h, c, b;
+  unsigned long s;
+
+  if (size < RAW_HEADER_SIZE)
+    return false;
+  memcpy(header, map, RAW_HEADER_SIZE);
+  header[RAW_HEADER_SIZE] = '\0';
+  if (sscanf(header, "RAWIMAGE %ld %ld %ld %ld %lu %2s",
+             &w, &h, &c, &b, &s, order) != 6)
+    return false;
+  if (w <= 0 || h <= 0 || w > 0x7fffffff || h > 0x7fffffff ||
+      c < 1 || c > 4 || (b != 8 && b != 16 && b != 32) ||
+      s < (unsigned long) (w * c * (b / 8)))
+    return false;
+  if (strcmp(order, "LE") != 0 && strcmp(order, "BE") != 0)
+    return false;
+  width     = (int32_t) w;
+  height    = (int32_t) h;
+  nComps    = (int8_t) c;
+  bpc       = (int8_t) b;
+  stride    = (size_t) s;
+  bigEndian = order[0] == 'B';
+  offset    = RAW_HEADER_SIZE;
+  return true;
+}
+
+int
+MappedImage::save (const std::string& filename, const Image& image,
+                   enum mapped_format_e format)
+{
+  MappedWriter writer(filename, image.getWidth(), image.getHeight(),
+                      image.getNComps(), image.getBPC(), format);
+  if (!writer.valid())
+    return -1;
+  for (int32_t y = 0; y < image.getHeight(); y++)
+    writer.writeRow(image.getRow(y));
+  return writer.close();
+}
+
+int
+MappedImage::formatOf (const std::string& filename)
+{
+  size_t dot = filename.rfind('.');
+  if (dot == std::string::npos)
+    return -1;
+  std::string ext = filename.substr(dot + 1);
+  for (size_t i = 0; i < ext.size(); i++)
+    ext[i] = tolower(ext[i]);
+
+  if (ext == "pgm" || ext == "ppm" || ext == "pnm")
+    return mapped_format_pnm;
+  if (ext == "pam")
+    return mapped_format_pam;
+  if (ext == "raw")
+    return mapped_format_raw;
+  return -1;
+}
+
+MappedWriter::MappedWriter (const std::string& filename,
+                            int32_t width, int32_t height,
+                            int8_t nComps, int8_t bpc,
+                            enum mapped_format_e format)
+{
+  static const char *const tupleType[] = {
+    "GRAYSCALE", "GRAYSCALE_ALPHA", "RGB", "RGB_ALPHA"
+  };
+  char header[256];
+
+  map      = NULL;
+  size     = 0;
+  this->height = height;
+  nextRow  = 0;
+  rowBytes = (size_t) width * nComps * (bpc / 8);
+  stride   = rowBytes;
+  swap     = false;
+
+  if (width <= 0 || height <= 0 || nComps < 1 || nComps > 4)
+    return;
+  if (format == mapped_format_raw) {
+    if (bpc != 8 && bpc != 16 && bpc != 32)
+      return;
+    stride = (rowBytes + RAW_ALIGN - 1) / RAW_ALIGN * RAW_ALIGN;
+    int n = snprintf(header, sizeof(header),
+                     "RAWIMAGE %d %d %d %d %lu %s",
+                     (int) width, (int) height, (int) nComps, (int) bpc,
+                     (unsigned long) stride, isBigEndian() ? "BE" : "LE");
+    if (n >= RAW_HEADER_SIZE)
+      return;
+    memset(header + n, ' ', RAW_HEADER_SIZE - 1 - n);
+    header[RAW_HEADER_SIZE - 1] = '\n';
+    header[RAW_HEADER_SIZE] = '\0';
+  } else {
+    // The Netpbm formats hold integer samples, most significant byte
+    // first.
+    if (bpc != 8 && bpc != 16)
+      return;
+    swap = bpc == 16 && !isBigEndian();
+    if (format == mapped_format_pnm) {
+      if (nComps != 1 && nComps != 3)
+        return;
+      snprintf(header, sizeof(header), "P%c\n%d %d\n%d\n",
+               nComps == 1 ? '5' : '6', (int) width, (int) height,
+               bpc == 8 ? 255 : 65535);
+    } else
+      snprintf(header, sizeof(header),
+               "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL %d\n"
+               "TUPLTYPE %s\nENDHDR\n",
+               (int) width, (int) height, (int) nComps,
+               bpc == 8 ? 255 : 65535, tupleType[nComps - 1]);
+  }
+  offset = strlen(header);
+  size   = offset + stride * height;
+
+  int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+    return;
+  if (ftruncate(fd, (off_t) size) == 0) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p != MAP_FAILED)
+      map = static_cast<uint8_t *>(p);
+  }
+  ::close(fd);
+  if (!map)
+    return;
+
+  madvise(map, size, MADV_SEQUENTIAL);
+  memcpy(map, header, offset);
+}
+
+MappedWriter::~MappedWriter ()
+{
+  if (map)
+    munmap(map, size);
+}
+
+bool
+MappedWriter::writeRow (const void *row)
+{
+  if (!map || nextRow >= height)
+    return false;
+
+  uint8_t *dst = map + offset + nextRow * stride;
+  if (swap)
+    copySwapped(dst, static_cast<const uint8_t *>(row), rowBytes / 2, 2);
+  else
+    memcpy(dst, row, rowBytes);
+  // Padding of raw rows is left as ftruncate() zero filled it.
+  nextRow++;
+  return true;
+}
+
+int
+MappedWriter::close ()
+{
+  if (!map)
+    return -1;
+
+  int status = nextRow == height ? 0 : -1;
+  if (munmap(map, size) != 0)
+    status = -1;
+  map = NULL;
+  return status;
+}
@@ -0,0 +1,101 @@
+#ifndef __MAPPEDIMAGE_HH__
+#define __MAPPEDIMAGE_HH__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+
+#include "Image.hh"
+#include "RowStream.hh"
+
+// Uncompressed file formats, read and written through mmap() so that
+// pipelines pay no codec cost.
+enum mapped_format_e
+{
+  mapped_format_pnm = 0, // P5 (gray) and P6 (RGB), 8 or 16 bpc
+  mapped_format_pam,     // P7 with 1 to 4 channels, 8 or 16 bpc
+  mapped_format_raw,     // RAWIMAGE header below, 8, 16 or 32 (float) bpc
+};
+
+// The raw format starts with a header of RAW_HEADER_SIZE bytes of text,
+//   "RAWIMAGE <width> <height> <nComps> <bpc> <stride> <LE|BE>\n"
+// padded with spaces, followed by height rows stride bytes apart of
+// interleaved samples in the given byte order. Rows written here start
+// on RAW_ALIGN byte boundaries of the file.
+#define RAW_HEADER_SIZE 64
+#define RAW_ALIGN       64
+
+// An image file mapped into memory. 8 bpc PNM and PAM files and raw files
+// in host byte order are used in place, without a copy; others are
+// converted to host byte order once. The mapping is private: changes to
+// the pixels never reach the file.
+class MappedImage : public Image
+{
+public:
+  // Read a file of any of the formats, recognized by its contents.
+  MappedImage(const std::string& filename);
+  ~MappedImage();
+
+  // Check if the file was mapped and its header understood.
+  bool valid() const { return isValid; };
+
+  // Write any image to a file of format, which must be able to hold it.
+  // Returns 0 on success.
+  static int save(const std::string& filename, const Image& image,
+                  enum mapped_format_e format);
+
+  // Format that the name of a file calls for: .pgm, .ppm and .pnm for PNM,
+  // .pam for PAM and .raw for raw. -1 for anything else.
+  static int formatOf(const std::string& filename);
+
+private:
+  // Views of the mapping must not outlive it.
+  MappedImage(const MappedImage&);
+  MappedImage& operator=(const MappedImage&);
+
+  bool parsePNM(size_t& offset, int32_t& width, int32_t& height,
+                int8_t& nComps, int8_t& bpc) const;
+  bool parsePAM(size_t& offset, int32_t& width, int32_t& height,
+                int8_t& nComps, int8_t& bpc) const;
+  bool parseRaw(size_t& offset, int32_t& width, int32_t& height,
+                int8_t& nComps, int8_t& bpc, size_t& stride,
+                bool& bigEndian) const;
+
+  uint8_t *map;
+  size_t   size;
+  bool     isValid;
+};
+
+// Writes a file of one of the mapped formats one row at a time, straight
+// into a shared mapping of the file.
+class MappedWriter : public RowSink
+{
+public:
+  MappedWriter(const std::string& filename, int32_t width, int32_t height,
+               int8_t nComps, int8_t bpc, enum mapped_format_e format);
+  virtual ~MappedWriter();
+
+  // Check if the file was created at its full size.
+  bool valid() const { return map != NULL; };
+
+  virtual bool writeRow(const void *row);
+
+  // Unmap the file after all rows are written. Returns 0 on success.
+  virtual int close();
+
+private:
+  MappedWriter(const MappedWriter&);
+  MappedWriter& operator=(const MappedWriter&);
+
+  uint8_t *map;
+  size_t   size;
+  size_t   offset;   // of the first row
+  size_t   stride;
+  size_t   rowBytes;
+  int32_t  height;
+  int32_t  nextRow;
+  bool     swap;     // 16 bpc samples to big-endian
+};
+
+#endif // __MAPPEDIMAGE_HH__
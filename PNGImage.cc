@@ -2,7 +2,9 @@
 // strlen
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -20,70 +22,56 @@
 #define PNG_NO_PROGRESSIVE_READ
 
 #include <png.h>
+#include <zlib.h>
 
 #include "PNGImage.hh"
+#include "ThreadPool.hh"
 
-// Creating an instance with data read from file
-PNGImage::PNGImage (const std::string filename) : Image(0, 0, 0, 0) // dummy
-{
-  FILE       *fp;
-  png_structp png_ptr;
-  png_infop   png_info_ptr;
-  png_byte    color_type, bpc, nComps;
-  png_uint_32 width, height, rowbytes;
-
-  fp = fopen(filename.c_str(), FOPEN_RBIN_MODE);
-  if(!fp) {
-    isValid = false;
-    return;
-  }
-
-  png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-  if (png_ptr == NULL ||
-      (png_info_ptr = png_create_info_struct(png_ptr)) == NULL) {
-    if (png_ptr)
-      png_destroy_read_struct(&png_ptr, NULL, NULL);
-    isValid = false;
-    return;
-  }
-
-#if PNG_LIBPNG_VER >= 10603
-  // ignore possibly incorrect CMF bytes
-  png_set_option(png_ptr, PNG_MAXIMUM_INFLATE_WINDOW, PNG_OPTION_ON);
-#endif
+// Bytes of IDAT chunks written by the parallel PNGWriter, and the deflate
+// window that primes each block.
+#define PNG_IDAT_BYTES  (256 * 1024)
+#define PNG_WINDOW_SIZE 32768
+// Bytes between checks of a filter cost against the best so far.
+#define PNG_COST_RUN    256
 
-  // Inititializing file IO.
-  png_init_io(png_ptr, fp);
-
-  // Read PNG info-header and get some info.
-  png_read_info(png_ptr, png_info_ptr);
-  color_type = png_get_color_type  (png_ptr, png_info_ptr);
-  width      = png_get_image_width (png_ptr, png_info_ptr);
-  height     = png_get_image_height(png_ptr, png_info_ptr);
-  bpc        = png_get_bit_depth   (png_ptr, png_info_ptr);
-  nComps     = png_get_channels    (png_ptr, png_info_ptr);
+// Row filters (PNG_FILTER_* bits), zlib level, strategy and memory level
+// of each profile, by png_profile_e.
+static const struct
+{
+  const char *name;
+  int filters;
+  int level;
+  int strategy;
+  int memLevel;
+} profiles[NUM_PNG_PROFILES] = {
+  { "fastest",  PNG_FILTER_UP,   1, Z_RLE,      8 },
+  { "balanced", PNG_ALL_FILTERS, 6, Z_FILTERED, 8 },
+  { "smallest", PNG_ALL_FILTERS, 9, Z_FILTERED, 9 },
+};
 
-  if (color_type == PNG_COLOR_TYPE_PALETTE) {
-    isValid = false;
-    return;
-  }
-  png_read_update_info(png_ptr, png_info_ptr);
+static bool
+isBigEndian (void)
+{
+  const uint16_t one = 1;
+  return *reinterpret_cast<const uint8_t *>(&one) == 0;
+}
 
+void
+PNGInfo::readInfo (png_structp png_ptr, png_infop png_info_ptr)
+{
   // Read colorspace information.
   bool hassRGB, hasiCCP, hasgAMA, hascHRM;
   hassRGB = hasiCCP = hasgAMA = hascHRM = false;
   // Precedence in this order.
   if (png_get_valid(png_ptr, png_info_ptr, PNG_INFO_iCCP)) {
-    png_charpp  name    = NULL;
+    png_charp   name    = NULL;
     int         compression_type = 0;
-    png_bytepp  profile = NULL;
+    png_bytep   profile = NULL;
     png_uint_32 proflen = 0;
     if (png_get_iCCP(png_ptr, png_info_ptr,
-                     name, &compression_type, profile, &proflen)) {
-      colorSpace.ICCP.name = std::string(*name, strlen(*name));
-      colorSpace.ICCP.profile.resize(proflen);
-      for (size_t i = 0; i < proflen; i++)
-        colorSpace.ICCP.profile[i] = (*profile)[i];
+                     &name, &compression_type, &profile, &proflen)) {
+      colorSpace.ICCP.name = std::string(name, strlen(name));
+      colorSpace.ICCP.profile.assign(profile, profile + proflen);
       colorSpaceType = png_colorspace_iccp;
       hasiCCP = true;
     }
@@ -122,60 +110,377 @@ PNGImage::PNGImage (const std::string filename) : Image(0, 0, 0, 0) // dummy
     }
   }
 
-  // Read raster image data.
-  rowbytes = png_get_rowbytes(png_ptr, png_info_ptr);
-  png_bytep stream_data_ptr = new png_byte[rowbytes * height];
+  // Resolution, pix-per-meter to ppi.
+  png_uint_32 res_x, res_y;
+  int         unit_type;
+  if (png_get_pHYs(png_ptr, png_info_ptr, &res_x, &res_y, &unit_type) &&
+      unit_type == PNG_RESOLUTION_METER && res_x > 0 && res_y > 0) {
+    dpi_x = res_x * 0.0254;
+    dpi_y = res_y * 0.0254;
+  }
+}
+
+void
+PNGInfo::writeInfo (png_structp png_ptr, png_infop png_info_ptr) const
+{
+  // Write colorspace related information.
+  switch (colorSpaceType) {
+  case png_colorspace_gamma_only:
+   png_set_gAMA(png_ptr, png_info_ptr, 1.0 / colorSpace.gamma);
+   break;
+  case png_colorspace_calibrated:
+    if (colorSpace.hasGamma)
+      png_set_gAMA(png_ptr, png_info_ptr, 1.0 / colorSpace.gamma);
+    png_set_cHRM(png_ptr, png_info_ptr,
+                 colorSpace.calRGB.xw, colorSpace.calRGB.yw,
+                 colorSpace.calRGB.xr, colorSpace.calRGB.yr,
+                 colorSpace.calRGB.xg, colorSpace.calRGB.yg,
+                 colorSpace.calRGB.xb, colorSpace.calRGB.yb);
+    break;
+  case png_colorspace_srgb:
+    png_set_sRGB(png_ptr, png_info_ptr, colorSpace.sRGB);
+    break;
+  case png_colorspace_iccp:
+    if (colorSpace.ICCP.profile.size() > 0) {
+      png_set_iCCP(png_ptr, png_info_ptr,
+                   colorSpace.ICCP.name.c_str(),
+                   PNG_COMPRESSION_TYPE_DEFAULT,
+                   colorSpace.ICCP.profile.data(),
+                   colorSpace.ICCP.profile.size());
+    }
+    break;
+  default:
+    assert(colorSpaceType == png_colorspace_device);
+    break;
+  }
+  // Resolution convert ppi to pix-per-meter
+  png_set_pHYs(png_ptr, png_info_ptr,
+               (dpi_x * 10000 + 127) / 254, // add 127 to round to nearest int.
+               (dpi_y * 10000 + 127) / 254,
+               PNG_RESOLUTION_METER);
+}
+
+PNGReader::PNGReader (const std::string& filename)
+{
+  png_byte color_type;
+
+  fp = NULL; png_ptr = NULL; png_info_ptr = NULL;
+  isValid = false;
+  width = height = 0; nComps = bpc = 0;
+  nextRow = 0;
+
+  fp = fopen(filename.c_str(), FOPEN_RBIN_MODE);
+  if(!fp)
+    return;
+
+  png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if (png_ptr == NULL ||
+      (png_info_ptr = png_create_info_struct(png_ptr)) == NULL) {
+    close();
+    return;
+  }
+
+#if PNG_LIBPNG_VER >= 10603
+  // ignore possibly incorrect CMF bytes
+  png_set_option(png_ptr, PNG_MAXIMUM_INFLATE_WINDOW, PNG_OPTION_ON);
+#endif
 
-  png_bytepp rows_p = new png_bytep[height];
-  for (uint32_t i = 0; i < height; i++)
-    rows_p[i] = &(stream_data_ptr[rowbytes * i]);
-  png_read_image(png_ptr, rows_p);
-  delete rows_p;
+  // Inititializing file IO.
+  png_init_io(png_ptr, fp);
 
-  // Reading file finished.
-  png_read_end(png_ptr, NULL);
+  // Read PNG info-header and get some info.
+  png_read_info(png_ptr, png_info_ptr);
+  color_type = png_get_color_type  (png_ptr, png_info_ptr);
+  width      = png_get_image_width (png_ptr, png_info_ptr);
+  height     = png_get_image_height(png_ptr, png_info_ptr);
+  bpc        = png_get_bit_depth   (png_ptr, png_info_ptr);
+  nComps     = png_get_channels    (png_ptr, png_info_ptr);
 
-  // Cleanup.
-  if (png_info_ptr)
-    png_destroy_info_struct(png_ptr, &png_info_ptr);
+  if (color_type == PNG_COLOR_TYPE_PALETTE) {
+    close();
+    return;
+  }
+  // Samples are at least 8 bits in the pixel buffer.
+  if (bpc < 8) {
+    png_set_expand_gray_1_2_4_to_8(png_ptr);
+    bpc = 8;
+  }
+  // 16 bpc samples are delivered in host byte order.
+  if (bpc == 16 && !isBigEndian())
+    png_set_swap(png_ptr);
+  if (png_get_interlace_type(png_ptr, png_info_ptr) != PNG_INTERLACE_NONE)
+    png_set_interlace_handling(png_ptr);
+  png_read_update_info(png_ptr, png_info_ptr);
+
+  readInfo(png_ptr, png_info_ptr);
+
+  isValid = true;
+}
+
+PNGReader::~PNGReader ()
+{
+  close();
+}
+
+void
+PNGReader::close ()
+{
   if (png_ptr)
-    png_destroy_read_struct(&png_ptr, NULL, NULL);
-  fclose(fp);
+    png_destroy_read_struct(&png_ptr, &png_info_ptr, NULL);
+  if (fp)
+    fclose(fp);
+  png_ptr = NULL; png_info_ptr = NULL;
+  fp = NULL;
+}
 
-  std::string raster(reinterpret_cast<const char *>(stream_data_ptr),
-                     rowbytes * height);
-  delete stream_data_ptr;
+bool
+PNGReader::readRow (void *row)
+{
+  if (!isValid || nextRow >= height)
+    return false;
 
-  // Actual timing of construction of Image base class is here.
-  Image::reset(width, height, nComps, bpc, raster);
+  if (png_get_interlace_type(png_ptr, png_info_ptr) != PNG_INTERLACE_NONE) {
+    // Every pass covers the whole image, so it must be decoded at once.
+    if (!deinterlaced) {
+      deinterlaced.reset(new Image(width, height, nComps, bpc));
+      png_bytepp rows_p = new png_bytep[height];
+      for (int32_t i = 0; i < height; i++)
+        rows_p[i] = deinterlaced->getRow(i);
+      png_read_image(png_ptr, rows_p);
+      delete[] rows_p;
+    }
+    memcpy(row, deinterlaced->getRow(nextRow), deinterlaced->getRowBytes());
+  } else {
+    png_read_row(png_ptr, static_cast<png_bytep>(row), NULL);
+  }
+
+  // Reading file finished.
+  if (++nextRow == height) {
+    png_read_end(png_ptr, NULL);
+    deinterlaced.reset();
+  }
+
+  return true;
 }
 
-int
-PNGImage::save (const std::string filename) const
+bool
+PNGReader::readRows (uint8_t *const *rows, int32_t count)
+{
+  if (!isValid || count > height - nextRow)
+    return false;
+
+  if (nextRow == 0 && count == height && !deinterlaced &&
+      png_get_interlace_type(png_ptr, png_info_ptr) != PNG_INTERLACE_NONE) {
+    png_read_image(png_ptr, const_cast<png_bytepp>(rows));
+    png_read_end(png_ptr, NULL);
+    nextRow = height;
+    return true;
+  }
+  for (int32_t i = 0; i < count; i++) {
+    if (!readRow(rows[i]))
+      return false;
+  }
+  return true;
+}
+
+// Without branches, p - a being b - c and so on.
+static inline int
+paeth (int a, int b, int c)
+{
+  int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+  int bc = pb <= pc ? b : c;
+  return pa <= pb && pa <= pc ? a : bc;
+}
+
+// Residual of filter F for byte x with a on its left, b above and c above
+// left.
+template <int F> static inline uint8_t
+residual (int x, int a, int b, int c)
+{
+  switch (F) {
+  case PNG_FILTER_VALUE_SUB:   return (uint8_t) (x - a);
+  case PNG_FILTER_VALUE_UP:    return (uint8_t) (x - b);
+  case PNG_FILTER_VALUE_AVG:   return (uint8_t) (x - ((a + b) >> 1));
+  case PNG_FILTER_VALUE_PAETH: return (uint8_t) (x - paeth(a, b, c));
+  default:                     return (uint8_t) x;
+  }
+}
+
+// Filter a row of n bytes with F; prev is the row above, zeros for the
+// first. out receives the filter type and the n filtered bytes.
+template <int F> static void
+applyFilter (uint8_t *out, const uint8_t *row, const uint8_t *prev,
+             size_t n, size_t bpp)
+{
+  out[0] = F;
+  out++;
+  for (size_t i = 0; i < bpp && i < n; i++)
+    out[i] = residual<F>(row[i], 0, prev[i], 0);
+  for (size_t i = bpp; i < n; i++)
+    out[i] = residual<F>(row[i], row[i - bpp], prev[i], prev[i - bpp]);
+}
+
+// Sum of the absolute (signed) residuals of filter F over a row, given up
+// once it exceeds limit. Bytes go in runs of PNG_COST_RUN, which keeps the
+// inner loop free of the left edge and of the limit.
+template <int F> static uint64_t
+filterCost (const uint8_t *row, const uint8_t *prev, size_t n, size_t bpp,
+            uint64_t limit)
 {
-  FILE       *fp;
-  png_structp png_ptr;
-  png_infop   png_info_ptr;
-  png_byte    color_type = PNG_COLOR_TYPE_RGB;
+  uint64_t sum = 0;
+  size_t   i = 0;
+
+  for (; i < bpp && i < n; i++)
+    sum += abs((int8_t) residual<F>(row[i], 0, prev[i], 0));
+  while (i < n && sum <= limit) {
+    size_t   end = std::min(n, i + PNG_COST_RUN);
+    uint32_t run = 0;
+    for (; i < end; i++)
+      run += abs((int8_t) residual<F>(row[i], row[i - bpp], prev[i],
+                                      prev[i - bpp]));
+    sum += run;
+  }
+  return sum;
+}
+
+// Filter a row with the one of filters, PNG_FILTER_* bits, whose residuals
+// have the least sum of absolute (signed) values, as libpng does. A sum is
+// abandoned as soon as it passes the best so far; with one filter there is
+// no choice to make.
+static void
+filterRow (uint8_t *out, const uint8_t *row, const uint8_t *prev,
+           size_t n, size_t bpp, int filters)
+{
+  int      best = -1;
+  uint64_t least = UINT64_MAX;
+
+  if ((filters & (filters - 1)) != 0) {
+    // Up first, the usual winner, to set a low limit for the others.
+    static const int order[5] = {
+      PNG_FILTER_VALUE_UP, PNG_FILTER_VALUE_SUB, PNG_FILTER_VALUE_PAETH,
+      PNG_FILTER_VALUE_AVG, PNG_FILTER_VALUE_NONE
+    };
+    for (int k = 0; k < 5; k++) {
+      int      f = order[k];
+      uint64_t cost;
+      if (!(filters & (PNG_FILTER_NONE << f)))
+        continue;
+      switch (f) {
+      case PNG_FILTER_VALUE_SUB:
+        cost = filterCost<PNG_FILTER_VALUE_SUB>(row, prev, n, bpp, least);
+        break;
+      case PNG_FILTER_VALUE_UP:
+        cost = filterCost<PNG_FILTER_VALUE_UP>(row, prev, n, bpp, least);
+        break;
+      case PNG_FILTER_VALUE_AVG:
+        cost = filterCost<PNG_FILTER_VALUE_AVG>(row, prev, n, bpp, least);
+        break;
+      case PNG_FILTER_VALUE_PAETH:
+        cost = filterCost<PNG_FILTER_VALUE_PAETH>(row, prev, n, bpp, least);
+        break;
+      default:
+        cost = filterCost<PNG_FILTER_VALUE_NONE>(row, prev, n, bpp, least);
+        break;
+      }
+      if (cost < least) {
+        least = cost;
+        best  = f;
+      }
+    }
+  } else {
+    for (int f = 0; f < 5; f++) {
+      if (filters & (PNG_FILTER_NONE << f))
+        best = f;
+    }
+  }
+
+  switch (best) {
+  case PNG_FILTER_VALUE_SUB:
+    applyFilter<PNG_FILTER_VALUE_SUB>(out, row, prev, n, bpp);   break;
+  case PNG_FILTER_VALUE_UP:
+    applyFilter<PNG_FILTER_VALUE_UP>(out, row, prev, n, bpp);    break;
+  case PNG_FILTER_VALUE_AVG:
+    applyFilter<PNG_FILTER_VALUE_AVG>(out, row, prev, n, bpp);   break;
+  case PNG_FILTER_VALUE_PAETH:
+    applyFilter<PNG_FILTER_VALUE_PAETH>(out, row, prev, n, bpp); break;
+  default:
+    applyFilter<PNG_FILTER_VALUE_NONE>(out, row, prev, n, bpp);  break;
+  }
+}
+
+// Deflate n bytes as a raw block of a stream, primed with the dictLen
+// bytes before them; the stream ends here if last, and is byte aligned
+// for the next block otherwise.
+static bool
+deflateBlock (std::vector<uint8_t>& out, const uint8_t *data, size_t n,
+              const uint8_t *dict, size_t dictLen, bool last,
+              enum png_profile_e profile)
+{
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  if (deflateInit2(&z, profiles[profile].level, Z_DEFLATED, -15,
+                   profiles[profile].memLevel,
+                   profiles[profile].strategy) != Z_OK)
+    return false;
+  if (dictLen > 0)
+    deflateSetDictionary(&z, dict, (uInt) dictLen);
+
+  // Room for all of it and a sync marker; grown if that is not enough.
+  out.resize(deflateBound(&z, n) + 16);
+  z.next_in   = const_cast<Bytef *>(data);
+  z.avail_in  = (uInt) n;
+  z.next_out  = out.data();
+  z.avail_out = (uInt) out.size();
+  int status;
+  for (;;) {
+    status = deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if (status == Z_STREAM_ERROR || z.avail_out > 0 || status == Z_STREAM_END)
+      break;
+    size_t done = out.size();
+    out.resize(done * 2);
+    z.next_out  = out.data() + done;
+    z.avail_out = (uInt) (out.size() - done);
+  }
+  out.resize(z.total_out);
+  deflateEnd(&z);
+
+  return last ? status == Z_STREAM_END : status == Z_OK && z.avail_in == 0;
+}
+
+PNGWriter::PNGWriter (const std::string& filename,
+                      int32_t width, int32_t height, int8_t nComps, int8_t bpc,
+                      const PNGInfo& info, ThreadPool *pool,
+                      enum png_profile_e profile)
+{
+  png_byte color_type = PNG_COLOR_TYPE_RGB;
+
+  png_ptr = NULL; png_info_ptr = NULL;
+  isValid = false;
+  this->height = height;
+  nextRow = 0;
+  this->pool = pool && pool->getThreads() > 1 ? pool : NULL;
+  this->profile = profile;
+  pixelBytes  = nComps * (bpc / 8);
+  rowBytes    = (size_t) width * pixelBytes;
+  swap        = bpc == 16 && !isBigEndian();
+  pendingRows = 0;
+  adler       = 1;
 
   fp = fopen(filename.c_str(), FOPEN_WBIN_MODE);
   if(!fp)
-    return -1;
+    return;
 
   png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
   if (png_ptr == NULL ||
       (png_info_ptr = png_create_info_struct(png_ptr)) == NULL) {
     if (png_ptr)
-      png_destroy_read_struct(&png_ptr, NULL, NULL);
-    return -1;
+      png_destroy_write_struct(&png_ptr, NULL);
+    fclose(fp);
+    fp = NULL; png_ptr = NULL;
+    return;
   }
 
-#if PNG_LIBPNG_VER >= 10603
-  // ignore possibly incorrect CMF bytes
-  png_set_option(png_ptr, PNG_MAXIMUM_INFLATE_WINDOW, PNG_OPTION_ON);
-#endif
-
-  switch (getNComps()) {
+  switch (nComps) {
   case 1:
     color_type = PNG_COLOR_TYPE_GRAY;
     break;
@@ -192,84 +497,263 @@ PNGImage::save (const std::string filename) const
   // Inititializing file IO.
   png_init_io(png_ptr, fp);
   // Write header (8 bit colour depth)
-  png_set_IHDR(png_ptr, png_info_ptr, getWidth(), getHeight(),
-               getBPC(), // BPC of original image data
+  png_set_IHDR(png_ptr, png_info_ptr, width, height,
+               bpc, // BPC of original image data
                color_type,
                PNG_INTERLACE_NONE,
                PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
 
-  // Write colorspace related information.
-  switch (colorSpaceType) {
-  case png_colorspace_gamma_only:
-   png_set_gAMA(png_ptr, png_info_ptr, 1.0 / colorSpace.gamma);
-   break;
-  case png_colorspace_calibrated:
-    if (colorSpace.hasGamma)
-      png_set_gAMA(png_ptr, png_info_ptr, 1.0 / colorSpace.gamma);
-    png_set_cHRM(png_ptr, png_info_ptr,
-                 colorSpace.calRGB.xw, colorSpace.calRGB.yw,
-                 colorSpace.calRGB.xr, colorSpace.calRGB.yr,
-                 colorSpace.calRGB.xg, colorSpace.calRGB.yg,
-                 colorSpace.calRGB.xb, colorSpace.calRGB.yb);
-    break;
-  case png_colorspace_srgb:
-    png_set_sRGB(png_ptr, png_info_ptr, colorSpace.sRGB);
-    break;
-  case png_colorspace_iccp:
-    if (colorSpace.ICCP.profile.size() > 0) {
-      png_set_iCCP(png_ptr, png_info_ptr,
-                   colorSpace.ICCP.name.c_str(),
-                   PNG_COMPRESSION_TYPE_DEFAULT,
-                   colorSpace.ICCP.profile.data(),
-                   colorSpace.ICCP.profile.size());
+  info.writeInfo(png_ptr, png_info_ptr);
+
+  png_write_info(png_ptr, png_info_ptr);
+
+  if (this->pool) {
+    // A batch is two blocks for each thread. The zlib header comes first:
+    // 32K window, no preset dictionary and the level class.
+    int32_t blockRows = std::max((size_t) 1, PNG_BLOCK_BYTES / (rowBytes + 1));
+    batchRows = std::min(blockRows * 2 * this->pool->getThreads(), height);
+    rows.resize(batchRows * rowBytes);
+    prior.assign(rowBytes, 0);
+    int level = profiles[profile].level;
+    int flags = (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6;
+    idat.push_back(0x78);
+    idat.push_back((uint8_t) (flags + 31 - (0x7800 + flags) % 31));
+  } else {
+    // libpng defaults are the balanced profile.
+    if (profile != png_profile_balanced) {
+      png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, profiles[profile].filters);
+      png_set_compression_level(png_ptr, profiles[profile].level);
+      png_set_compression_strategy(png_ptr, profiles[profile].strategy);
+      png_set_compression_mem_level(png_ptr, profiles[profile].memLevel);
     }
-    break;
-  default:
-    assert(colorSpaceType == png_colorspace_device);
-    break;
+    // Rows are given with 16 bpc samples in host byte order.
+    if (swap)
+      png_set_swap(png_ptr);
   }
-  // Resolution convert ppi to pix-per-meter
-  png_set_pHYs(png_ptr, png_info_ptr,
-               (dpi_x * 10000 + 127) / 254, // add 127 to round to nearest int.
-               (dpi_y * 10000 + 127) / 254,
-               PNG_RESOLUTION_METER);
 
-  png_write_info(png_ptr, png_info_ptr);
+  isValid = true;
+}
 
-  // Write raster image body.
-  png_bytep row = new png_byte[getWidth() * (getBPC() / 8) * getNComps()];
-  if (getBPC() == 8) {
-    for (int32_t j = 0; j < getHeight(); j++) {
-      for (int32_t i = 0; i < getWidth(); i++) {
-        Color pixel = getPixel(i, j);
-        for (int c = 0; c < getNComps(); c++) {
-          row[getNComps() * i + c] = 255 * ((float) pixel.v[c] / 65535.) + .5;
-        }
+PNGWriter::~PNGWriter ()
+{
+  close();
+}
+
+bool
+PNGWriter::writeRow (const void *row)
+{
+  if (!isValid || nextRow >= height)
+    return false;
+
+  if (pool) {
+    uint8_t *dst = rows.data() + pendingRows * rowBytes;
+    const uint8_t *src = static_cast<const uint8_t *>(row);
+    if (swap) {
+      for (size_t i = 0; i < rowBytes; i += 2) {
+        dst[i]     = src[i + 1];
+        dst[i + 1] = src[i];
       }
-      png_write_row(png_ptr, row);
+    } else
+      memcpy(dst, src, rowBytes);
+    nextRow++;
+    if (++pendingRows == batchRows)
+      flushBlocks(nextRow == height);
+    return true;
+  }
+
+  // libpng does not modify the row, its prototype is not const.
+  png_write_row(png_ptr, static_cast<png_bytep>(const_cast<void *>(row)));
+  nextRow++;
+
+  return true;
+}
+
+// Filter and deflate the pending rows on the pool, the last ones of the
+// image if last.
+void
+PNGWriter::flushBlocks (bool last)
+{
+  size_t  stride    = rowBytes + 1;
+  int32_t count     = pendingRows;
+  int32_t blockRows = std::max((size_t) 1, PNG_BLOCK_BYTES / stride);
+  int32_t blocks    = (count + blockRows - 1) / blockRows;
+
+  filtered.resize(count * stride);
+  pool->parallelFor(count, [&](int32_t begin, int32_t end) {
+    for (int32_t i = begin; i < end; i++) {
+      const uint8_t *prev = i > 0 ? &rows[(i - 1) * rowBytes] : prior.data();
+      filterRow(&filtered[i * stride], &rows[i * rowBytes], prev, rowBytes,
+                pixelBytes, profiles[profile].filters);
     }
-  } else {
-    for (int32_t j = 0; j < getHeight(); j++) {
-      for (int32_t i = 0; i < getWidth(); i++) {
-        Color   pixel = getPixel(i, j);
-        int32_t pos   = 2 * getNComps() * i;
-        for (int c = 0; c < getNComps(); c++) {
-          uint16_t val = pixel.v[c];
-          row[pos + 2 * c] = (val >> 8) & 0xff;
-          row[pos + 2 * c + 1] =  val & 0xff;
-        }
-      }
-      png_write_row(png_ptr, row);
+  });
+
+  std::vector<std::vector<uint8_t> > out(blocks);
+  std::vector<unsigned long> sums(blocks);
+  std::vector<char> ok(blocks);
+  pool->parallelFor(blocks, [&](int32_t begin, int32_t end) {
+    for (int32_t k = begin; k < end; k++) {
+      size_t first = std::min((size_t) k * blockRows, (size_t) count) * stride;
+      size_t limit = std::min((size_t) (k + 1) * blockRows,
+                              (size_t) count) * stride;
+      const uint8_t *dict = k == 0 ? window.data() :
+          &filtered[first - std::min(first, (size_t) PNG_WINDOW_SIZE)];
+      size_t dictLen = k == 0 ? window.size() :
+          std::min(first, (size_t) PNG_WINDOW_SIZE);
+      sums[k] = adler32(1, filtered.data() + first, limit - first);
+      ok[k] = deflateBlock(out[k], filtered.data() + first, limit - first,
+                           dict, dictLen, last && k == blocks - 1, profile);
     }
+  });
+
+  for (int32_t k = 0; k < blocks; k++) {
+    size_t length = std::min((size_t) (k + 1) * blockRows, (size_t) count) *
+                    stride - std::min((size_t) k * blockRows,
+                                      (size_t) count) * stride;
+    if (!ok[k])
+      isValid = false;
+    adler = adler32_combine(adler, sums[k], length);
+    idat.insert(idat.end(), out[k].begin(), out[k].end());
   }
-  delete row;
 
-  png_write_end(png_ptr, NULL);
-  if (png_info_ptr)
-    png_free_data(png_ptr, png_info_ptr, PNG_FREE_ALL, -1);
-  if (png_ptr)
-    png_destroy_write_struct(&png_ptr, (png_infopp) NULL);
-  fclose(fp);
+  // The window of the next batch.
+  if (filtered.size() >= PNG_WINDOW_SIZE)
+    window.assign(filtered.end() - PNG_WINDOW_SIZE, filtered.end());
+  else {
+    window.insert(window.end(), filtered.begin(), filtered.end());
+    if (window.size() > PNG_WINDOW_SIZE)
+      window.erase(window.begin(), window.end() - PNG_WINDOW_SIZE);
+  }
+  if (count > 0)
+    prior.assign(rows.begin() + (count - 1) * rowBytes,
+                 rows.begin() + count * rowBytes);
+  pendingRows = 0;
 
-  return 0;
+  if (last) {
+    for (int shift = 24; shift >= 0; shift -= 8)
+      idat.push_back((uint8_t) (adler >> shift));
+  }
+  writeIDAT(last);
+}
+
+// Write the compressed data in chunks of PNG_IDAT_BYTES, and what remains
+// too if all.
+void
+PNGWriter::writeIDAT (bool all)
+{
+  static const png_byte name[5] = { 'I', 'D', 'A', 'T', '\0' };
+  size_t done = 0;
+
+  while (idat.size() - done >= PNG_IDAT_BYTES ||
+         (all && done < idat.size())) {
+    size_t length = std::min(idat.size() - done, (size_t) PNG_IDAT_BYTES);
+    png_write_chunk(png_ptr, name, idat.data() + done, length);
+    done += length;
+  }
+  idat.erase(idat.begin(), idat.begin() + done);
+}
+
+int
+PNGWriter::close ()
+{
+  int error = 0;
+
+  if (!png_ptr)
+    return isValid ? 0 : -1;
+
+  // A truncated file is not finished, libpng would complain.
+  if (isValid && nextRow == height && pool) {
+    // The IDAT chunks were written here, libpng does not know of them.
+    static const png_byte name[5] = { 'I', 'E', 'N', 'D', '\0' };
+    if (pendingRows > 0)
+      flushBlocks(true);
+    png_write_chunk(png_ptr, name, NULL, 0);
+  } else if (isValid && nextRow == height)
+    png_write_end(png_ptr, NULL);
+  else
+    error = -1;
+  png_free_data(png_ptr, png_info_ptr, PNG_FREE_ALL, -1);
+  png_destroy_write_struct(&png_ptr, &png_info_ptr);
+  if (fclose(fp) != 0)
+    error = -1;
+  fp = NULL; png_ptr = NULL; png_info_ptr = NULL;
+  isValid = (error == 0);
+
+  return error;
+}
+
+// Creating an instance with data read from file
+PNGImage::PNGImage (const std::string filename) : Image(0, 0, 0, 0) // dummy
+{
+  PNGReader reader(filename);
+  load(reader);
+}
+
+PNGImage::PNGImage (PNGReader& reader) : Image(0, 0, 0, 0) // dummy
+{
+  load(reader);
+}
+
+void
+PNGImage::load (PNGReader& reader)
+{
+  isValid = false;
+  if (!reader.valid())
+    return;
+  setInfo(reader);
+
+  // Actual timing of construction of Image base class is here.
+  Image::reset(reader.getWidth(), reader.getHeight(),
+               reader.getNComps(), reader.getBPC());
+
+  // Read raster image data directly into the pixel buffer.
+  std::vector<uint8_t *> rows(getHeight());
+  for (int32_t i = 0; i < getHeight(); i++)
+    rows[i] = getRow(i);
+  if (!reader.readRows(rows.data(), getHeight()))
+    return;
+
+  isValid = true;
+}
+
+int
+PNGImage::save (const std::string filename) const
+{
+  return save(filename, *this, *this);
+}
+
+int
+PNGImage::save (const std::string filename, const Image& image,
+                const PNGInfo& info, ThreadPool *pool,
+                enum png_profile_e profile)
+{
+  if (image.getBPC() != 8 && image.getBPC() != 16)
+    return -1;
+
+  PNGWriter writer(filename, image.getWidth(), image.getHeight(),
+                   image.getNComps(), image.getBPC(), info, pool, profile);
+
+  if (!writer.valid())
+    return -1;
+
+  // Write raster image body.
+  for (int32_t j = 0; j < image.getHeight(); j++)
+    writer.writeRow(image.getRow(j));
+
+  return writer.close();
+}
+
+int
+PNGImage::profileOf (const std::string& name)
+{
+  for (int i = 0; i < NUM_PNG_PROFILES; i++) {
+    if (name == profiles[i].name)
+      return i;
+  }
+  return -1;
+}
+
+const char *
+PNGImage::getProfileName (enum png_profile_e profile)
+{
+  return profiles[profile].name;
 }
@@ -1,8 +1,19 @@
 #ifndef __PNGIMAGE_HH__
 #define __PNGIMAGE_HH__
 
+#include <stdio.h>
+
+#include <memory>
+#include <string>
 #include <vector>
 #include "Image.hh"
+#include "RowStream.hh"
+
+// libpng structures, see png.h.
+struct png_struct_def;
+struct png_info_def;
+
+class ThreadPool;
 
 enum png_colorspace_type_e
 {
@@ -13,30 +24,20 @@ enum png_colorspace_type_e
   png_colorspace_gamma_only, // only gAMA specified
 };
 
-class PNGImage : public Image
+// Colorspace and resolution of a PNG file, kept apart from the pixels so
+// that they can be carried from a PNGReader to a PNGWriter.
+class PNGInfo
 {
 public:
-  PNGImage(int32_t width, int32_t height, int8_t nComps, int8_t bpc) :
-    Image(width, height, nComps, bpc)
-    {
-      isValid = true; colorSpaceType = png_colorspace_device;
-      dpi_x = dpi_y = 72;
-    };
-  PNGImage(int32_t width, int32_t height, int8_t nComps, int8_t bpc,
-           const std::string raster) :
-      Image(width, height, nComps, bpc, raster)
+  PNGInfo()
     {
-      isValid = true; colorSpaceType = png_colorspace_device;
+      colorSpaceType = png_colorspace_device;
+      colorSpace.hasGamma = false;
       dpi_x = dpi_y = 72;
     };
-  // Read data from file and construct PNGImage object.
-  PNGImage(const std::string filename);
-  // Save to file.
-  int  save(const std::string filename) const;
-  // Check if load image succeeded.
-  bool valid() const { return isValid; };
 
-  enum png_colorspace_type_e getColorSpaceType() { return colorSpaceType; };
+  enum png_colorspace_type_e getColorSpaceType() const
+      { return colorSpaceType; };
   bool hasGamma() const { return colorSpace.hasGamma; };
 
   std::string getICCProfileName() const { return colorSpace.ICCP.name; };
@@ -79,6 +80,8 @@ public:
     colorSpace.calRGB.xb = xb;
     colorSpace.calRGB.yb = yb;
   }
+  // Copy all of colorspace and resolution.
+  void setInfo(const PNGInfo& info) { *this = info; };
 
   float getResolutionX() const { return dpi_x; };
   float getResolutionY() const { return dpi_y; };
@@ -86,9 +89,15 @@ public:
   void  setResolutionY(float dpi) { dpi_y = dpi; };
   void  setResolution (float x, float y) { dpi_x = x; dpi_y = y; };
 
-private:
+protected:
+  // Transfer from/to libpng structures, after png_read_info() and before
+  // png_write_info() respectively.
+  void readInfo (struct png_struct_def *png_ptr, struct png_info_def *info_ptr);
+  void writeInfo(struct png_struct_def *png_ptr,
+                 struct png_info_def *info_ptr) const;
 
-  bool isValid;
+private:
+  friend class PNGWriter;
 
   struct ICCP {
     std::string name;
@@ -112,4 +121,150 @@ private:
   float dpi_x, dpi_y;
 };
 
+// Reads a PNG file one row at a time, so that the whole image never has to
+// be in memory. Interlaced files can not be read that way; they are decoded
+// whole on the first readRow() and served from there.
+class PNGReader : public RowSource, public PNGInfo
+{
+public:
+  PNGReader(const std::string& filename);
+  virtual ~PNGReader();
+
+  // Check if the file was opened and its header read.
+  bool valid() const { return isValid; };
+
+  virtual int32_t getWidth()  const { return width; };
+  virtual int32_t getHeight() const { return height; };
+  virtual int8_t  getNComps() const { return nComps; };
+  virtual int8_t  getBPC()    const { return bpc; };
+
+  virtual bool readRow(void *row);
+  // Read the next count rows. All rows of an interlaced file read at once
+  // go straight into place.
+  bool readRows(uint8_t *const *rows, int32_t count);
+
+private:
+  PNGReader(const PNGReader&);
+  PNGReader& operator=(const PNGReader&);
+
+  void close();
+
+  FILE                  *fp;
+  struct png_struct_def *png_ptr;
+  struct png_info_def   *png_info_ptr;
+
+  bool    isValid;
+  int32_t width, height;
+  int8_t  nComps, bpc;
+  int32_t nextRow;
+
+  std::unique_ptr<Image> deinterlaced;
+};
+
+// Effort spent compressing: the row filters tried, zlib level and strategy.
+enum png_profile_e
+{
+  png_profile_fastest = 0, // Up filter only, level 1, run-length matches
+  png_profile_balanced,    // libpng defaults: adaptive filters, level 6
+  png_profile_smallest,    // adaptive filters, level 9, more zlib memory
+  NUM_PNG_PROFILES
+};
+
+// Filtered bytes deflated as one block by the parallel PNGWriter.
+#define PNG_BLOCK_BYTES (256 * 1024)
+
+// Writes a PNG file one row at a time. Colorspace and resolution are taken
+// from info at construction.
+//
+// With a pool of more than one thread, rows are filtered and compressed
+// on its threads instead of by libpng: every PNG_BLOCK_BYTES of filtered
+// rows are deflated on their own, primed with the 32K of data before
+// them, and the blocks are joined into one zlib stream across the IDAT
+// chunks, as pigz does. The pixels decode the same either way.
+class PNGWriter : public RowSink
+{
+public:
+  PNGWriter(const std::string& filename, int32_t width, int32_t height,
+            int8_t nComps, int8_t bpc, const PNGInfo& info,
+            ThreadPool *pool = NULL,
+            enum png_profile_e profile = png_profile_balanced);
+  virtual ~PNGWriter();
+
+  // Check if the file was created and its header written.
+  bool valid() const { return isValid; };
+
+  virtual bool writeRow(const void *row);
+
+  // Finish the file after all rows are written. Returns 0 on success.
+  virtual int close();
+
+private:
+  PNGWriter(const PNGWriter&);
+  PNGWriter& operator=(const PNGWriter&);
+
+  void flushBlocks(bool last);
+  void writeIDAT(bool all);
+
+  FILE                  *fp;
+  struct png_struct_def *png_ptr;
+  struct png_info_def   *png_info_ptr;
+
+  bool    isValid;
+  int32_t height;
+  int32_t nextRow;
+
+  enum png_profile_e profile;
+
+  // Parallel compression, used if pool is not NULL.
+  ThreadPool *pool;
+  size_t      rowBytes;
+  int8_t      pixelBytes;
+  bool        swap;        // 16 bpc samples to big-endian
+  int32_t     batchRows;   // rows compressed at once
+  int32_t     pendingRows;
+  std::vector<uint8_t> rows;     // pending, in PNG byte order
+  std::vector<uint8_t> prior;    // row before them, zeros for none
+  std::vector<uint8_t> filtered;
+  std::vector<uint8_t> window;   // last 32K of filtered data
+  std::vector<uint8_t> idat;     // compressed, not yet written
+  unsigned long        adler;
+};
+
+class PNGImage : public Image, public PNGInfo
+{
+public:
+  PNGImage(int32_t width, int32_t height, int8_t nComps, int8_t bpc) :
+    Image(width, height, nComps, bpc)
+    {
+      isValid = true;
+    };
+  PNGImage(int32_t width, int32_t height, int8_t nComps, int8_t bpc,
+           const std::string& raster) :
+      Image(width, height, nComps, bpc, raster)
+    {
+      isValid = true;
+    };
+  // Read data from file and construct PNGImage object.
+  PNGImage(const std::string filename);
+  // Read all rows of a reader that has none consumed yet.
+  PNGImage(PNGReader& reader);
+  // Save to file.
+  int  save(const std::string filename) const;
+  // Save any 8 or 16 bpc image, rows are written straight from its pixel
+  // buffer. Compression runs on pool if given, see PNGWriter.
+  static int save(const std::string filename, const Image& image,
+                  const PNGInfo& info, ThreadPool *pool = NULL,
+                  enum png_profile_e profile = png_profile_balanced);
+  // Profile of a name: "fastest", "balanced" or "smallest"; -1 for others.
+  static int profileOf(const std::string& name);
+  static const char *getProfileName(enum png_profile_e profile);
+  // Check if load image succeeded.
+  bool valid() const { return isValid; };
+
+private:
+  void load(PNGReader& reader);
+
+  bool isValid;
+};
+
 #endif // __PNGIMAGE_HH__
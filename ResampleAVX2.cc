@@ -0,0 +1,551 @@
+// AVX2 + FMA row kernels, see ResampleKernels.hh.
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <string.h>
+#include <immintrin.h>
+
+#include "ResampleKernels.hh"
+
+namespace {
+
+// Load four or eight samples as float.
+template <typename T> inline __m128 load4(const T *p);
+template <typename T> inline __m256 load8(const T *p);
+
+template <> inline __m128
+load4<uint8_t> (const uint8_t *p)
+{
+  int32_t v;
+  memcpy(&v, p, sizeof(v));
+  return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(v)));
+}
+
+template <> inline __m128
+load4<uint16_t> (const uint16_t *p)
+{
+  __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+  return _mm_cvtepi32_ps(_mm_cvtepu16_epi32(x));
+}
+
+template <> inline __m128
+load4<float> (const float *p)
+{
+  return _mm_loadu_ps(p);
+}
+
+template <> inline __m256
+load8<uint8_t> (const uint8_t *p)
+{
+  __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+  return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(x));
+}
+
+template <> inline __m256
+load8<uint16_t> (const uint16_t *p)
+{
+  __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(x));
+}
+
+template <> inline __m256
+load8<float> (const float *p)
+{
+  return _mm256_loadu_ps(p);
+}
+
+template <typename T> inline __m128
+load3 (const T *p)
+{
+  return _mm_setr_ps(p[0], p[1], p[2], 0.0f);
+}
+
+// Sum of the two 128 bit halves.
+inline __m128
+fold (__m256 v)
+{
+  return _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+}
+
+inline float
+hsum (__m128 v)
+{
+  __m128 t = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  t = _mm_add_ss(t, _mm_movehdup_ps(t));
+  return _mm_cvtss_f32(t);
+}
+
+// Broadcast weights of four taps to the lanes of interleaved samples.
+inline __m256
+spread (const float *w, __m256i index)
+{
+  return _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_loadu_ps(w)),
+                                  index);
+}
+
+template <typename T, int TAPS> void
+convolveX1 (float *out, const void *src, int32_t width,
+            const int32_t *start, const float *weights,
+            int32_t taps, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const T *in = static_cast<const T *>(src);
+
+  for (int32_t i = 0; i < width; i++) {
+    const T     *p = in + start[i];
+    const float *w = weights + i * taps;
+    __m256  acc8 = _mm256_setzero_ps();
+    __m128  acc4 = _mm_setzero_ps();
+    int32_t j    = 0;
+    for (; j + 8 <= taps; j += 8)
+      acc8 = _mm256_fmadd_ps(load8<T>(p + j), _mm256_loadu_ps(w + j), acc8);
+    for (; j + 4 <= taps; j += 4)
+      acc4 = _mm_fmadd_ps(load4<T>(p + j), _mm_loadu_ps(w + j), acc4);
+    float sum = hsum(_mm_add_ps(acc4, fold(acc8)));
+    for (; j < taps; j++)
+      sum += p[j] * w[j];
+    out[i] = sum * scale;
+  }
+}
+
+template <typename T, int TAPS> void
+convolveX2 (float *out, const void *src, int32_t width,
+            const int32_t *start, const float *weights,
+            int32_t taps, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const T *in    = static_cast<const T *>(src);
+  __m256i  index = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+
+  for (int32_t i = 0; i < width; i++) {
+    const T     *p = in + 2 * start[i];
+    const float *w = weights + i * taps;
+    __m256  acc8 = _mm256_setzero_ps();
+    int32_t j    = 0;
+    for (; j + 4 <= taps; j += 4)
+      acc8 = _mm256_fmadd_ps(load8<T>(p + 2 * j), spread(w + j, index), acc8);
+    __m128 acc = fold(acc8);
+    for (; j + 2 <= taps; j += 2) {
+      __m128 wv = _mm_setr_ps(w[j], w[j], w[j + 1], w[j + 1]);
+      acc = _mm_fmadd_ps(load4<T>(p + 2 * j), wv, acc);
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    if (j < taps)
+      acc = _mm_fmadd_ps(_mm_setr_ps(p[2 * j], p[2 * j + 1], 0.0f, 0.0f),
+                         _mm_set1_ps(w[j]), acc);
+    acc = _mm_mul_ps(acc, _mm_set1_ps(scale));
+    _mm_storel_pi(reinterpret_cast<__m64 *>(out + 2 * i), acc);
+  }
+}
+
+template <typename T, int TAPS> void
+convolveX3 (float *out, const void *src, int32_t width,
+            const int32_t *start, const float *weights,
+            int32_t taps, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const T *in    = static_cast<const T *>(src);
+  // Samples of two pixels to lanes 0-2 and 4-6, weights to match.
+  __m256i  gather = _mm256_setr_epi32(0, 1, 2, 2, 3, 4, 5, 5);
+  __m256i  index  = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+
+  for (int32_t i = 0; i < width; i++) {
+    const T     *p = in + 3 * start[i];
+    const float *w = weights + i * taps;
+    __m256  acc8 = _mm256_setzero_ps();
+    int32_t j    = 0;
+    // Eight samples from tap j stay inside the window while j + 2 < taps.
+    for (; j + 2 < taps; j += 2) {
+      __m256 s  = _mm256_permutevar8x32_ps(load8<T>(p + 3 * j), gather);
+      __m128 w2 = _mm_castsi128_ps(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i *>(w + j)));
+      __m256 wv = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(w2), index);
+      acc8 = _mm256_fmadd_ps(s, wv, acc8);
+    }
+    __m128 acc = fold(acc8);
+    for (; j + 1 < taps; j++)
+      acc = _mm_fmadd_ps(load4<T>(p + 3 * j), _mm_set1_ps(w[j]), acc);
+    acc = _mm_fmadd_ps(load3<T>(p + 3 * j), _mm_set1_ps(w[j]), acc);
+    acc = _mm_mul_ps(acc, _mm_set1_ps(scale));
+    if (i + 1 < width) {
+      // The fourth lane is overwritten by the next pixel.
+      _mm_storeu_ps(out + 3 * i, acc);
+    } else {
+      float v[4];
+      _mm_storeu_ps(v, acc);
+      out[3 * i] = v[0]; out[3 * i + 1] = v[1]; out[3 * i + 2] = v[2];
+    }
+  }
+}
+
+template <typename T, int TAPS> void
+convolveX4 (float *out, const void *src, int32_t width,
+            const int32_t *start, const float *weights,
+            int32_t taps, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const T *in  = static_cast<const T *>(src);
+  __m256i  lo  = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+  __m256i  hi  = _mm256_setr_epi32(2, 2, 2, 2, 3, 3, 3, 3);
+
+  for (int32_t i = 0; i < width; i++) {
+    const T     *p = in + 4 * start[i];
+    const float *w = weights + i * taps;
+    __m256  acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    int32_t j    = 0;
+    for (; j + 4 <= taps; j += 4) {
+      acc0 = _mm256_fmadd_ps(load8<T>(p + 4 * j),     spread(w + j, lo), acc0);
+      acc1 = _mm256_fmadd_ps(load8<T>(p + 4 * j + 8), spread(w + j, hi), acc1);
+    }
+    __m128 acc = fold(_mm256_add_ps(acc0, acc1));
+    for (; j < taps; j++)
+      acc = _mm_fmadd_ps(load4<T>(p + 4 * j), _mm_set1_ps(w[j]), acc);
+    _mm_storeu_ps(out + 4 * i, _mm_mul_ps(acc, _mm_set1_ps(scale)));
+  }
+}
+
+// Store sixteen scaled samples, rounded and clamped to the sample type.
+template <typename T> inline void store16(T *p, __m256 a, __m256 b);
+template <typename T> inline T    store1(float v);
+
+template <> inline void
+store16<uint8_t> (uint8_t *p, __m256 a, __m256 b)
+{
+  // Packs work within 128 bit lanes; restore the order with permutes.
+  __m256i x = _mm256_packus_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+  x = _mm256_permute4x64_epi64(x, 0xd8);
+  x = _mm256_permute4x64_epi64(_mm256_packus_epi16(x, x), 0x08);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(p), _mm256_castsi256_si128(x));
+}
+
+template <> inline void
+store16<uint16_t> (uint16_t *p, __m256 a, __m256 b)
+{
+  __m256i x = _mm256_packus_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+  x = _mm256_permute4x64_epi64(x, 0xd8);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), x);
+}
+
+template <> inline void
+store16<float> (float *p, __m256 a, __m256 b)
+{
+  _mm256_storeu_ps(p, a);
+  _mm256_storeu_ps(p + 8, b);
+}
+
+template <> inline uint8_t  store1<uint8_t> (float v) { return clampToUint8(v); }
+template <> inline uint16_t store1<uint16_t>(float v) { return clampToUint16(v); }
+template <> inline float    store1<float>   (float v) { return v; }
+
+template <typename T, int TAPS> void
+convolveY (void *dst, const float *const *rows, const float *weights,
+           int32_t taps, int32_t n, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  T      *out = static_cast<T *>(dst);
+  __m256  s   = _mm256_set1_ps(scale);
+  int32_t k   = 0;
+
+  for (; k + 16 <= n; k += 16) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    for (int32_t j = 0; j < taps; j++) {
+      __m256 w = _mm256_set1_ps(weights[j]);
+      acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(rows[j] + k),     w, acc0);
+      acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(rows[j] + k + 8), w, acc1);
+    }
+    store16<T>(out + k, _mm256_mul_ps(acc0, s), _mm256_mul_ps(acc1, s));
+  }
+  for (; k < n; k++) {
+    float acc = 0.0f;
+    for (int32_t j = 0; j < taps; j++)
+      acc += rows[j][k] * weights[j];
+    out[k] = store1<T>(acc * scale);
+  }
+}
+
+template <typename T, int TAPS> void
+convolveYSource (float *out, const void *const *src, const float *weights,
+                 int32_t taps, int32_t n, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const T *const *rows = reinterpret_cast<const T *const *>(src);
+  __m256  s = _mm256_set1_ps(scale);
+  int32_t k = 0;
+
+  for (; k + 16 <= n; k += 16) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    for (int32_t j = 0; j < taps; j++) {
+      __m256 w = _mm256_set1_ps(weights[j]);
+      acc0 = _mm256_fmadd_ps(load8<T>(rows[j] + k),     w, acc0);
+      acc1 = _mm256_fmadd_ps(load8<T>(rows[j] + k + 8), w, acc1);
+    }
+    _mm256_storeu_ps(out + k,     _mm256_mul_ps(acc0, s));
+    _mm256_storeu_ps(out + k + 8, _mm256_mul_ps(acc1, s));
+  }
+  for (; k < n; k++) {
+    float acc = 0.0f;
+    for (int32_t j = 0; j < taps; j++)
+      acc += rows[j][k] * weights[j];
+    out[k] = acc * scale;
+  }
+}
+
+// Fixed point kernels for 8 bpc samples, see ResampleSSE2.cc.
+
+inline __m128i
+loadu32 (const void *p)
+{
+  int32_t v;
+  memcpy(&v, p, sizeof(v));
+  return _mm_cvtsi32_si128(v);
+}
+
+inline int32_t
+weightPair (int16_t w0, int16_t w1)
+{
+  return (uint16_t) w0 | ((uint32_t) (uint16_t) w1 << 16);
+}
+
+// Three samples, the fourth is zero.
+inline __m128i
+loadu24 (const uint8_t *p)
+{
+  return _mm_cvtsi32_si128(p[0] | (p[1] << 8) | (p[2] << 16));
+}
+
+// Three channels, two output pixels at a time as for four channels. Two
+// taps r0 g0 b0 r1 g1 b1 are paired up as r0 r1 g0 g1 b0 b1 0 0.
+template <int TAPS> void
+convolveXFixed3 (int16_t *out, const uint8_t *in, int32_t width,
+                 const int32_t *start, const int16_t *weights, int32_t taps)
+{
+  if (TAPS)
+    taps = TAPS;
+  const __m256i order = _mm256_setr_epi8(0, 1, 6, 7, 2, 3, 8, 9,
+                                         4, 5, 10, 11, -1, -1, -1, -1,
+                                         0, 1, 6, 7, 2, 3, 8, 9,
+                                         4, 5, 10, 11, -1, -1, -1, -1);
+  const __m128i pack  = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 8, 9,
+                                      10, 11, 12, 13, -1, -1, -1, -1);
+  const __m256i round = _mm256_set1_epi32(1 << (FIXED_X_SHIFT - 1));
+  int32_t i = 0;
+
+  for (; i + 2 <= width; i += 2) {
+    const uint8_t *p0 = in + 3 * start[i];
+    const uint8_t *p1 = in + 3 * start[i + 1];
+    const int16_t *w0 = weights + i * taps;
+    const int16_t *w1 = w0 + taps;
+    __m256i acc = _mm256_setzero_si256();
+    int32_t j   = 0;
+    // Eight bytes reach two samples into the tap after the pair.
+    for (; j + 2 < taps; j += 2) {
+      __m128i x = _mm_unpacklo_epi64(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p0 + 3 * j)),
+          _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p1 + 3 * j)));
+      __m256i v  = _mm256_shuffle_epi8(_mm256_cvtepu8_epi16(x), order);
+      int32_t a  = weightPair(w0[j], w0[j + 1]);
+      int32_t b  = weightPair(w1[j], w1[j + 1]);
+      __m256i wv = _mm256_setr_epi32(a, a, a, a, b, b, b, b);
+      acc = _mm256_add_epi32(acc, _mm256_madd_epi16(v, wv));
+    }
+    for (; j < taps; j++) {
+      __m128i x = _mm_unpacklo_epi64(loadu24(p0 + 3 * j), loadu24(p1 + 3 * j));
+      __m256i v  = _mm256_shuffle_epi8(_mm256_cvtepu8_epi16(x), order);
+      int32_t a  = weightPair(w0[j], 0);
+      int32_t b  = weightPair(w1[j], 0);
+      __m256i wv = _mm256_setr_epi32(a, a, a, a, b, b, b, b);
+      acc = _mm256_add_epi32(acc, _mm256_madd_epi16(v, wv));
+    }
+    acc = _mm256_srai_epi32(_mm256_add_epi32(acc, round), FIXED_X_SHIFT);
+    acc = _mm256_permute4x64_epi64(_mm256_packs_epi32(acc, acc), 0x08);
+    __m128i v = _mm_shuffle_epi8(_mm256_castsi256_si128(acc), pack);
+    if (i + 2 < width) {
+      // The last two samples are overwritten by the next pixel.
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 3 * i), v);
+    } else {
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 3 * i), v);
+      int32_t rest = _mm_extract_epi32(v, 2);
+      memcpy(out + 3 * i + 4, &rest, sizeof(rest));
+    }
+  }
+  for (; i < width; i++) {
+    const uint8_t *p = in + 3 * start[i];
+    const int16_t *w = weights + i * taps;
+    int32_t acc[3] = { 0, 0, 0 };
+    for (int32_t j = 0; j < taps; j++) {
+      for (int c = 0; c < 3; c++)
+        acc[c] += p[3 * j + c] * w[j];
+    }
+    for (int c = 0; c < 3; c++)
+      out[3 * i + c] = fixedToInt16(acc[c]);
+  }
+}
+
+// Four channels, two output pixels at a time, one per 128 bit lane. In
+// each lane the samples of two taps r0 g0 b0 a0 r1 g1 b1 a1 are paired up
+// as r0 r1 g0 g1 b0 b1 a0 a1 against the weights of the lane's pixel.
+template <int TAPS> void
+convolveXFixed4 (int16_t *out, const uint8_t *in, int32_t width,
+                 const int32_t *start, const int16_t *weights, int32_t taps)
+{
+  if (TAPS)
+    taps = TAPS;
+  const __m256i order = _mm256_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11,
+                                         4, 5, 12, 13, 6, 7, 14, 15,
+                                         0, 1, 8, 9, 2, 3, 10, 11,
+                                         4, 5, 12, 13, 6, 7, 14, 15);
+  const __m256i round = _mm256_set1_epi32(1 << (FIXED_X_SHIFT - 1));
+  int32_t i = 0;
+
+  for (; i + 2 <= width; i += 2) {
+    const uint8_t *p0 = in + 4 * start[i];
+    const uint8_t *p1 = in + 4 * start[i + 1];
+    const int16_t *w0 = weights + i * taps;
+    const int16_t *w1 = w0 + taps;
+    __m256i acc = _mm256_setzero_si256();
+    int32_t j   = 0;
+    for (; j + 2 <= taps; j += 2) {
+      __m128i x = _mm_unpacklo_epi64(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p0 + 4 * j)),
+          _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p1 + 4 * j)));
+      __m256i v  = _mm256_shuffle_epi8(_mm256_cvtepu8_epi16(x), order);
+      int32_t a  = weightPair(w0[j], w0[j + 1]);
+      int32_t b  = weightPair(w1[j], w1[j + 1]);
+      __m256i wv = _mm256_setr_epi32(a, a, a, a, b, b, b, b);
+      acc = _mm256_add_epi32(acc, _mm256_madd_epi16(v, wv));
+    }
+    if (j < taps) {
+      __m128i x = _mm_unpacklo_epi64(loadu32(p0 + 4 * j), loadu32(p1 + 4 * j));
+      __m256i v  = _mm256_shuffle_epi8(_mm256_cvtepu8_epi16(x), order);
+      int32_t a  = weightPair(w0[j], 0);
+      int32_t b  = weightPair(w1[j], 0);
+      __m256i wv = _mm256_setr_epi32(a, a, a, a, b, b, b, b);
+      acc = _mm256_add_epi32(acc, _mm256_madd_epi16(v, wv));
+    }
+    acc = _mm256_srai_epi32(_mm256_add_epi32(acc, round), FIXED_X_SHIFT);
+    acc = _mm256_permute4x64_epi64(_mm256_packs_epi32(acc, acc), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 4 * i),
+                     _mm256_castsi256_si128(acc));
+  }
+  for (; i < width; i++) {
+    const uint8_t *p = in + 4 * start[i];
+    const int16_t *w = weights + i * taps;
+    __m128i acc = _mm_setzero_si128();
+    for (int32_t j = 0; j < taps; j++)
+      acc = _mm_add_epi32(acc, _mm_mullo_epi32(
+          _mm_cvtepu8_epi32(loadu32(p + 4 * j)), _mm_set1_epi32(w[j])));
+    acc = _mm_srai_epi32(_mm_add_epi32(acc,
+                                       _mm_set1_epi32(1 << (FIXED_X_SHIFT - 1))),
+                         FIXED_X_SHIFT);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 4 * i),
+                     _mm_packs_epi32(acc, acc));
+  }
+}
+
+template <int TAPS> void
+convolveYFixed (uint8_t *out, const int16_t *const *rows,
+                const int16_t *weights, int32_t taps, int32_t n)
+{
+  if (TAPS)
+    taps = TAPS;
+  const __m256i round = _mm256_set1_epi32(1 << (FIXED_Y_SHIFT - 1));
+  int32_t k = 0;
+
+  for (; k + 16 <= n; k += 16) {
+    __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+    for (int32_t j = 0; j < taps; j += 2) {
+      __m256i r0 = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(rows[j] + k));
+      __m256i r1 = j + 1 < taps ? _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(rows[j + 1] + k)) :
+          _mm256_setzero_si256();
+      __m256i wv = _mm256_set1_epi32(
+          weightPair(weights[j], j + 1 < taps ? weights[j + 1] : 0));
+      lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(r0, r1),
+                                                  wv));
+      hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(r0, r1),
+                                                  wv));
+    }
+    lo = _mm256_srai_epi32(_mm256_add_epi32(lo, round), FIXED_Y_SHIFT);
+    hi = _mm256_srai_epi32(_mm256_add_epi32(hi, round), FIXED_Y_SHIFT);
+    // Unpacking and packing both stay within 128 bit lanes, so the order
+    // is restored except for the final pack.
+    __m256i x = _mm256_packs_epi32(lo, hi);
+    x = _mm256_permute4x64_epi64(_mm256_packus_epi16(x, x), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + k),
+                     _mm256_castsi256_si128(x));
+  }
+  for (; k < n; k++) {
+    int32_t acc = 0;
+    for (int32_t j = 0; j < taps; j++)
+      acc += rows[j][k] * weights[j];
+    out[k] = fixedToUint8(acc);
+  }
+}
+
+// Row sums of the box reduction.
+template <typename T> void
+boxY (float *acc, const void *src, int32_t n)
+{
+  const T *in = static_cast<const T *>(src);
+  int32_t  k  = 0;
+
+  for (; k + 8 <= n; k += 8)
+    _mm256_storeu_ps(acc + k, _mm256_add_ps(_mm256_loadu_ps(acc + k), load8<T>(in + k)));
+  for (; k < n; k++)
+    acc[k] += in[k];
+}
+
+template <typename T, int TAPS> void
+setupConvolveX (ConvolveRowX *row)
+{
+  row[0] = convolveX1<T, TAPS>;
+  row[1] = convolveX2<T, TAPS>;
+  row[2] = convolveX3<T, TAPS>;
+  row[3] = convolveX4<T, TAPS>;
+}
+
+// Kernels for windows of TAPS taps, any number if 0.
+template <int TAPS> void
+setupTaps (struct ResampleKernels *kernels)
+{
+  const int c = TAPS / TAP_CLASS_STEP;
+
+  setupConvolveX<uint8_t,  TAPS>(kernels->convolveX[c][sample_uint8]);
+  setupConvolveX<uint16_t, TAPS>(kernels->convolveX[c][sample_uint16]);
+  setupConvolveX<float,    TAPS>(kernels->convolveX[c][sample_float]);
+  kernels->convolveY[c][sample_uint8]  = convolveY<uint8_t,  TAPS>;
+  kernels->convolveY[c][sample_uint16] = convolveY<uint16_t, TAPS>;
+  kernels->convolveY[c][sample_float]  = convolveY<float,    TAPS>;
+  kernels->convolveYSource[c][sample_uint8]  = convolveYSource<uint8_t,  TAPS>;
+  kernels->convolveYSource[c][sample_uint16] = convolveYSource<uint16_t, TAPS>;
+  kernels->convolveYSource[c][sample_float]  = convolveYSource<float,    TAPS>;
+  // Other channel counts keep the SSE2 versions.
+  kernels->convolveXFixed[c][2] = convolveXFixed3<TAPS>;
+  kernels->convolveXFixed[c][3] = convolveXFixed4<TAPS>;
+  kernels->convolveYFixed[c]    = convolveYFixed<TAPS>;
+}
+
+} // namespace
+
+void
+setupResampleKernelsAVX2 (struct ResampleKernels *kernels)
+{
+  kernels->name = "avx2";
+  setupTaps<0> (kernels);
+  setupTaps<4> (kernels);
+  setupTaps<8> (kernels);
+  setupTaps<12>(kernels);
+  setupTaps<16>(kernels);
+  kernels->boxY[sample_uint8]  = boxY<uint8_t>;
+  kernels->boxY[sample_uint16] = boxY<uint16_t>;
+  kernels->boxY[sample_float]  = boxY<float>;
+}
+
+#endif // x86
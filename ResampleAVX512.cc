@@ -0,0 +1,330 @@
+// AVX-512 (F, BW and VL) row kernels, see ResampleKernels.hh. Kernels that do
+// not gain from wider vectors are left to the AVX2 versions.
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// GCC 12 warns about the _mm512_undefined_*() inside its own intrinsics.
+#if defined(__GNUC__) && !defined(__clang__)
+#  pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include <immintrin.h>
+
+#include "ResampleKernels.hh"
+
+namespace {
+
+// Load eight or sixteen samples as float.
+template <typename T> inline __m256 load8(const T *p);
+template <typename T> inline __m512 load16(const T *p);
+
+template <> inline __m256
+load8<uint8_t> (const uint8_t *p)
+{
+  __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+  return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(x));
+}
+
+template <> inline __m256
+load8<uint16_t> (const uint16_t *p)
+{
+  __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(x));
+}
+
+template <> inline __m256
+load8<float> (const float *p)
+{
+  return _mm256_loadu_ps(p);
+}
+
+template <> inline __m512
+load16<uint8_t> (const uint8_t *p)
+{
+  __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(x));
+}
+
+template <> inline __m512
+load16<uint16_t> (const uint16_t *p)
+{
+  __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+  return _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(x));
+}
+
+template <> inline __m512
+load16<float> (const float *p)
+{
+  return _mm512_loadu_ps(p);
+}
+
+inline __m128
+fold (__m256 v)
+{
+  return _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+}
+
+inline __m256
+fold (__m512 v)
+{
+  return _mm256_add_ps(_mm512_castps512_ps256(v),
+                       _mm256_castpd_ps(_mm512_extractf64x4_pd(
+                                            _mm512_castps_pd(v), 1)));
+}
+
+inline float
+hsum (__m128 v)
+{
+  __m128 t = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  t = _mm_add_ss(t, _mm_movehdup_ps(t));
+  return _mm_cvtss_f32(t);
+}
+
+template <typename T, int TAPS> void
+convolveX1 (float *out, const void *src, int32_t width,
+            const int32_t *start, const float *weights,
+            int32_t taps, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const T *in = static_cast<const T *>(src);
+
+  for (int32_t i = 0; i < width; i++) {
+    const T     *p = in + start[i];
+    const float *w = weights + i * taps;
+    __m512  acc16 = _mm512_setzero_ps();
+    __m256  acc8  = _mm256_setzero_ps();
+    int32_t j     = 0;
+    for (; j + 16 <= taps; j += 16)
+      acc16 = _mm512_fmadd_ps(load16<T>(p + j), _mm512_loadu_ps(w + j), acc16);
+    for (; j + 8 <= taps; j += 8)
+      acc8 = _mm256_fmadd_ps(load8<T>(p + j), _mm256_loadu_ps(w + j), acc8);
+    // Remaining taps through a masked load of up to seven samples.
+    if (j < taps) {
+      __mmask8 mask = (__mmask8) ((1u << (taps - j)) - 1);
+      __m256   s;
+      if (sizeof(T) == 1)
+        s = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+                _mm_maskz_loadu_epi8(mask, p + j)));
+      else if (sizeof(T) == 2)
+        s = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(
+                _mm_maskz_loadu_epi16(mask, p + j)));
+      else
+        s = _mm256_maskz_loadu_ps(mask, p + j);
+      acc8 = _mm256_fmadd_ps(s, _mm256_maskz_loadu_ps(mask, w + j), acc8);
+    }
+    out[i] = hsum(fold(_mm256_add_ps(acc8, fold(acc16)))) * scale;
+  }
+}
+
+template <typename T, int TAPS> void
+convolveX2 (float *out, const void *src, int32_t width,
+            const int32_t *start, const float *weights,
+            int32_t taps, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const T *in    = static_cast<const T *>(src);
+  __m512i  index = _mm512_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3,
+                                     4, 4, 5, 5, 6, 6, 7, 7);
+
+  for (int32_t i = 0; i < width; i++) {
+    const T     *p = in + 2 * start[i];
+    const float *w = weights + i * taps;
+    __m512  acc = _mm512_setzero_ps();
+    int32_t j   = 0;
+    for (; j + 8 <= taps; j += 8) {
+      __m512 wv = _mm512_permutexvar_ps(index,
+                      _mm512_zextps256_ps512(_mm256_loadu_ps(w + j)));
+      acc = _mm512_fmadd_ps(load16<T>(p + 2 * j), wv, acc);
+    }
+    // Up to seven taps left, fourteen samples.
+    if (j < taps) {
+      __mmask16 mask = (__mmask16) ((1u << (2 * (taps - j))) - 1);
+      __m512    s;
+      if (sizeof(T) == 1)
+        s = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(
+                _mm_maskz_loadu_epi8(mask, p + 2 * j)));
+      else if (sizeof(T) == 2)
+        s = _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(
+                _mm256_maskz_loadu_epi16(mask, p + 2 * j)));
+      else
+        s = _mm512_maskz_loadu_ps(mask, p + 2 * j);
+      __m512 wv = _mm512_permutexvar_ps(index, _mm512_zextps256_ps512(
+                      _mm256_maskz_loadu_ps((__mmask8) ((1u << (taps - j)) - 1),
+                                            w + j)));
+      acc = _mm512_fmadd_ps(s, wv, acc);
+    }
+    __m128 sum = fold(fold(acc));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_mul_ps(sum, _mm_set1_ps(scale));
+    _mm_storel_pi(reinterpret_cast<__m64 *>(out + 2 * i), sum);
+  }
+}
+
+template <typename T, int TAPS> void
+convolveX4 (float *out, const void *src, int32_t width,
+            const int32_t *start, const float *weights,
+            int32_t taps, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const T *in    = static_cast<const T *>(src);
+  __m512i  index = _mm512_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1,
+                                     2, 2, 2, 2, 3, 3, 3, 3);
+
+  for (int32_t i = 0; i < width; i++) {
+    const T     *p = in + 4 * start[i];
+    const float *w = weights + i * taps;
+    __m512  acc = _mm512_setzero_ps();
+    int32_t j   = 0;
+    for (; j + 4 <= taps; j += 4) {
+      __m512 wv = _mm512_permutexvar_ps(index,
+                      _mm512_zextps128_ps512(_mm_loadu_ps(w + j)));
+      acc = _mm512_fmadd_ps(load16<T>(p + 4 * j), wv, acc);
+    }
+    // Up to three taps left, twelve samples.
+    if (j < taps) {
+      __mmask16 mask = (__mmask16) ((1u << (4 * (taps - j))) - 1);
+      __m512    s;
+      if (sizeof(T) == 1)
+        s = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(
+                _mm_maskz_loadu_epi8(mask, p + 4 * j)));
+      else if (sizeof(T) == 2)
+        s = _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(
+                _mm256_maskz_loadu_epi16(mask, p + 4 * j)));
+      else
+        s = _mm512_maskz_loadu_ps(mask, p + 4 * j);
+      __m512 wv = _mm512_permutexvar_ps(index, _mm512_zextps128_ps512(
+                      _mm_maskz_loadu_ps((__mmask8) ((1u << (taps - j)) - 1),
+                                         w + j)));
+      acc = _mm512_fmadd_ps(s, wv, acc);
+    }
+    _mm_storeu_ps(out + 4 * i,
+                  _mm_mul_ps(fold(fold(acc)), _mm_set1_ps(scale)));
+  }
+}
+
+// Store up to sixteen scaled samples, rounded and clamped to the sample
+// type, under a mask.
+template <typename T> inline void store16(T *p, __mmask16 mask, __m512 v);
+
+template <> inline void
+store16<uint8_t> (uint8_t *p, __mmask16 mask, __m512 v)
+{
+  __m512i x = _mm512_max_epi32(_mm512_cvtps_epi32(v), _mm512_setzero_si512());
+  _mm512_mask_cvtusepi32_storeu_epi8(p, mask, x);
+}
+
+template <> inline void
+store16<uint16_t> (uint16_t *p, __mmask16 mask, __m512 v)
+{
+  __m512i x = _mm512_max_epi32(_mm512_cvtps_epi32(v), _mm512_setzero_si512());
+  _mm512_mask_cvtusepi32_storeu_epi16(p, mask, x);
+}
+
+template <> inline void
+store16<float> (float *p, __mmask16 mask, __m512 v)
+{
+  _mm512_mask_storeu_ps(p, mask, v);
+}
+
+template <typename T, int TAPS> void
+convolveY (void *dst, const float *const *rows, const float *weights,
+           int32_t taps, int32_t n, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  T      *out = static_cast<T *>(dst);
+  __m512  s   = _mm512_set1_ps(scale);
+  int32_t k   = 0;
+
+  for (; k + 32 <= n; k += 32) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    for (int32_t j = 0; j < taps; j++) {
+      __m512 w = _mm512_set1_ps(weights[j]);
+      acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(rows[j] + k),      w, acc0);
+      acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(rows[j] + k + 16), w, acc1);
+    }
+    store16<T>(out + k,      0xffff, _mm512_mul_ps(acc0, s));
+    store16<T>(out + k + 16, 0xffff, _mm512_mul_ps(acc1, s));
+  }
+  // Remainder in masked steps of sixteen.
+  for (; k < n; k += 16) {
+    __mmask16 mask = n - k >= 16 ? 0xffff : (__mmask16) ((1u << (n - k)) - 1);
+    __m512    acc  = _mm512_setzero_ps();
+    for (int32_t j = 0; j < taps; j++)
+      acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, rows[j] + k),
+                            _mm512_set1_ps(weights[j]), acc);
+    store16<T>(out + k, mask, _mm512_mul_ps(acc, s));
+  }
+}
+
+template <typename T, int TAPS> void
+convolveYSource (float *out, const void *const *src, const float *weights,
+                 int32_t taps, int32_t n, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const T *const *rows = reinterpret_cast<const T *const *>(src);
+  __m512  s = _mm512_set1_ps(scale);
+  int32_t k = 0;
+
+  for (; k + 32 <= n; k += 32) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    for (int32_t j = 0; j < taps; j++) {
+      __m512 w = _mm512_set1_ps(weights[j]);
+      acc0 = _mm512_fmadd_ps(load16<T>(rows[j] + k),      w, acc0);
+      acc1 = _mm512_fmadd_ps(load16<T>(rows[j] + k + 16), w, acc1);
+    }
+    _mm512_storeu_ps(out + k,      _mm512_mul_ps(acc0, s));
+    _mm512_storeu_ps(out + k + 16, _mm512_mul_ps(acc1, s));
+  }
+  for (; k < n; k++) {
+    float acc = 0.0f;
+    for (int32_t j = 0; j < taps; j++)
+      acc += rows[j][k] * weights[j];
+    out[k] = acc * scale;
+  }
+}
+
+template <typename T, int TAPS> void
+setupConvolveX (ConvolveRowX *row)
+{
+  row[0] = convolveX1<T, TAPS>;
+  row[1] = convolveX2<T, TAPS>;
+  // Three channels keep the AVX2 version.
+  row[3] = convolveX4<T, TAPS>;
+}
+
+// Kernels for windows of TAPS taps, any number if 0.
+template <int TAPS> void
+setupTaps (struct ResampleKernels *kernels)
+{
+  const int c = TAPS / TAP_CLASS_STEP;
+
+  setupConvolveX<uint8_t,  TAPS>(kernels->convolveX[c][sample_uint8]);
+  setupConvolveX<uint16_t, TAPS>(kernels->convolveX[c][sample_uint16]);
+  setupConvolveX<float,    TAPS>(kernels->convolveX[c][sample_float]);
+  kernels->convolveY[c][sample_uint8]  = convolveY<uint8_t,  TAPS>;
+  kernels->convolveY[c][sample_uint16] = convolveY<uint16_t, TAPS>;
+  kernels->convolveY[c][sample_float]  = convolveY<float,    TAPS>;
+  kernels->convolveYSource[c][sample_uint8]  = convolveYSource<uint8_t,  TAPS>;
+  kernels->convolveYSource[c][sample_uint16] = convolveYSource<uint16_t, TAPS>;
+  kernels->convolveYSource[c][sample_float]  = convolveYSource<float,    TAPS>;
+}
+
+} // namespace
+
+void
+setupResampleKernelsAVX512 (struct ResampleKernels *kernels)
+{
+  kernels->name = "avx512";
+  setupTaps<0> (kernels);
+  setupTaps<4> (kernels);
+  setupTaps<8> (kernels);
+  setupTaps<12>(kernels);
+  setupTaps<16>(kernels);
+}
+
+#endif // x86
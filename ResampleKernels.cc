@@ -0,0 +1,305 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "ResampleKernels.hh"
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define HAVE_X86_KERNELS 1
+#endif
+
+enum isa_level_e
+{
+  isa_scalar = 0,
+  isa_sse2,
+  isa_avx2,
+  isa_avx512
+};
+
+static int
+detectISA (void)
+{
+  int level = isa_scalar;
+
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    level = isa_sse2;
+  if (level == isa_sse2 &&
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    level = isa_avx2;
+  if (level == isa_avx2 &&
+      __builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl"))
+    level = isa_avx512;
+#endif
+
+  // Allow lowering the level, never raising it above what the CPU has.
+  const char *env = getenv("RESAMPLE_ISA");
+  if (env) {
+    int limit = level;
+    if (!strcmp(env, "scalar"))
+      limit = isa_scalar;
+    else if (!strcmp(env, "sse2"))
+      limit = isa_sse2;
+    else if (!strcmp(env, "avx2"))
+      limit = isa_avx2;
+    else if (!strcmp(env, "avx512"))
+      limit = isa_avx512;
+    if (limit < level)
+      level = limit;
+  }
+
+  return level;
+}
+
+// Portable kernels, also the fallback for anything a vector set lacks.
+template <typename T, int nComps, int TAPS> static void
+convolveX (float *out, const void *src, int32_t width,
+           const int32_t *start, const float *weights,
+           int32_t taps, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const T *in = static_cast<const T *>(src);
+
+  for (int32_t i = 0; i < width; i++) {
+    const T     *p = in + start[i] * nComps;
+    const float *w = weights + i * taps;
+    float acc[nComps];
+    for (int c = 0; c < nComps; c++)
+      acc[c] = 0.0f;
+    for (int32_t j = 0; j < taps; j++) {
+      for (int c = 0; c < nComps; c++)
+        acc[c] += p[j * nComps + c] * w[j];
+    }
+    for (int c = 0; c < nComps; c++)
+      out[i * nComps + c] = acc[c] * scale;
+  }
+}
+
+template <typename T> static inline T store1(float v);
+template <> inline uint8_t  store1<uint8_t> (float v) { return clampToUint8(v); }
+template <> inline uint16_t store1<uint16_t>(float v) { return clampToUint16(v); }
+template <> inline float    store1<float>   (float v) { return v; }
+
+// Rows are accumulated a block at a time, taps in the outer loop, so that
+// each row is read sequentially.
+template <typename T, int TAPS> static void
+convolveY (void *dst, const float *const *rows, const float *weights,
+           int32_t taps, int32_t n, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const int32_t BLOCK = 256;
+  T    *out = static_cast<T *>(dst);
+  float acc[BLOCK];
+
+  for (int32_t k0 = 0; k0 < n; k0 += BLOCK) {
+    int32_t len = n - k0 < BLOCK ? n - k0 : BLOCK;
+    for (int32_t k = 0; k < len; k++)
+      acc[k] = 0.0f;
+    for (int32_t j = 0; j < taps; j++) {
+      const float *row = rows[j] + k0;
+      float        w   = weights[j];
+      for (int32_t k = 0; k < len; k++)
+        acc[k] += row[k] * w;
+    }
+    for (int32_t k = 0; k < len; k++)
+      out[k0 + k] = store1<T>(acc[k] * scale);
+  }
+}
+
+template <typename T, int TAPS> static void
+convolveYSource (float *out, const void *const *src, const float *weights,
+                 int32_t taps, int32_t n, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const T *const *rows = reinterpret_cast<const T *const *>(src);
+
+  for (int32_t k = 0; k < n; k++)
+    out[k] = 0.0f;
+  for (int32_t j = 0; j < taps; j++) {
+    const T *row = rows[j];
+    float    w   = weights[j];
+    for (int32_t k = 0; k < n; k++)
+      out[k] += row[k] * w;
+  }
+  for (int32_t k = 0; k < n; k++)
+    out[k] *= scale;
+}
+
+template <int nComps, int TAPS> static void
+convolveXFixed (int16_t *out, const uint8_t *in, int32_t width,
+                const int32_t *start, const int16_t *weights, int32_t taps)
+{
+  if (TAPS)
+    taps = TAPS;
+  for (int32_t i = 0; i < width; i++) {
+    const uint8_t *p = in + start[i] * nComps;
+    const int16_t *w = weights + i * taps;
+    int32_t acc[nComps];
+    for (int c = 0; c < nComps; c++)
+      acc[c] = 0;
+    for (int32_t j = 0; j < taps; j++) {
+      for (int c = 0; c < nComps; c++)
+        acc[c] += p[j * nComps + c] * w[j];
+    }
+    for (int c = 0; c < nComps; c++)
+      out[i * nComps + c] = fixedToInt16(acc[c]);
+  }
+}
+
+template <int TAPS> static void
+convolveYFixed (uint8_t *out, const int16_t *const *rows,
+                const int16_t *weights, int32_t taps, int32_t n)
+{
+  if (TAPS)
+    taps = TAPS;
+  const int32_t BLOCK = 256;
+  int32_t acc[BLOCK];
+
+  for (int32_t k0 = 0; k0 < n; k0 += BLOCK) {
+    int32_t len = n - k0 < BLOCK ? n - k0 : BLOCK;
+    for (int32_t k = 0; k < len; k++)
+      acc[k] = 0;
+    for (int32_t j = 0; j < taps; j++) {
+      const int16_t *row = rows[j] + k0;
+      int32_t        w   = weights[j];
+      for (int32_t k = 0; k < len; k++)
+        acc[k] += row[k] * w;
+    }
+    for (int32_t k = 0; k < len; k++)
+      out[k0 + k] = fixedToUint8(acc[k]);
+  }
+}
+
+template <typename T> static void
+boxY (float *acc, const void *src, int32_t n)
+{
+  const T *in = static_cast<const T *>(src);
+
+  for (int32_t k = 0; k < n; k++)
+    acc[k] += in[k];
+}
+
+template <typename T, int nComps, int KX> static void
+boxX (void *dst, const float *acc, int32_t width, int32_t kx, float scale)
+{
+  if (KX)
+    kx = KX;
+  T *out = static_cast<T *>(dst);
+
+  for (int32_t i = 0; i < width; i++) {
+    const float *p = acc + i * kx * nComps;
+    float sum[nComps];
+    for (int c = 0; c < nComps; c++)
+      sum[c] = 0.0f;
+    for (int32_t j = 0; j < kx; j++) {
+      for (int c = 0; c < nComps; c++)
+        sum[c] += p[j * nComps + c];
+    }
+    for (int c = 0; c < nComps; c++)
+      out[i * nComps + c] = store1<T>(sum[c] * scale);
+  }
+}
+
+template <typename T, int TAPS> static void
+setupConvolveX (ConvolveRowX *row)
+{
+  row[0] = convolveX<T, 1, TAPS>;
+  row[1] = convolveX<T, 2, TAPS>;
+  row[2] = convolveX<T, 3, TAPS>;
+  row[3] = convolveX<T, 4, TAPS>;
+}
+
+// Kernels for windows of TAPS taps, any number if 0.
+template <int TAPS> static void
+setupTaps (struct ResampleKernels *kernels)
+{
+  const int c = TAPS / TAP_CLASS_STEP;
+
+  setupConvolveX<uint8_t,  TAPS>(kernels->convolveX[c][sample_uint8]);
+  setupConvolveX<uint16_t, TAPS>(kernels->convolveX[c][sample_uint16]);
+  setupConvolveX<float,    TAPS>(kernels->convolveX[c][sample_float]);
+  kernels->convolveY[c][sample_uint8]  = convolveY<uint8_t,  TAPS>;
+  kernels->convolveY[c][sample_uint16] = convolveY<uint16_t, TAPS>;
+  kernels->convolveY[c][sample_float]  = convolveY<float,    TAPS>;
+  kernels->convolveYSource[c][sample_uint8]  = convolveYSource<uint8_t,  TAPS>;
+  kernels->convolveYSource[c][sample_uint16] = convolveYSource<uint16_t, TAPS>;
+  kernels->convolveYSource[c][sample_float]  = convolveYSource<float,    TAPS>;
+  kernels->convolveXFixed[c][0] = convolveXFixed<1, TAPS>;
+  kernels->convolveXFixed[c][1] = convolveXFixed<2, TAPS>;
+  kernels->convolveXFixed[c][2] = convolveXFixed<3, TAPS>;
+  kernels->convolveXFixed[c][3] = convolveXFixed<4, TAPS>;
+  kernels->convolveYFixed[c]    = convolveYFixed<TAPS>;
+}
+
+template <typename T, int KX> static void
+setupBoxX (BoxRowX *row)
+{
+  row[0] = boxX<T, 1, KX>;
+  row[1] = boxX<T, 2, KX>;
+  row[2] = boxX<T, 3, KX>;
+  row[3] = boxX<T, 4, KX>;
+}
+
+// Box kernels for a factor of KX, any factor if 0.
+template <int KX> static void
+setupBox (struct ResampleKernels *kernels)
+{
+  const int c = boxClass(KX);
+
+  setupBoxX<uint8_t,  KX>(kernels->boxX[c][sample_uint8]);
+  setupBoxX<uint16_t, KX>(kernels->boxX[c][sample_uint16]);
+  setupBoxX<float,    KX>(kernels->boxX[c][sample_float]);
+}
+
+void
+setupResampleKernelsScalar (struct ResampleKernels *kernels)
+{
+  kernels->name = "scalar";
+  setupTaps<0> (kernels);
+  setupTaps<4> (kernels);
+  setupTaps<8> (kernels);
+  setupTaps<12>(kernels);
+  setupTaps<16>(kernels);
+  kernels->boxY[sample_uint8]  = boxY<uint8_t>;
+  kernels->boxY[sample_uint16] = boxY<uint16_t>;
+  kernels->boxY[sample_float]  = boxY<float>;
+  setupBox<0>(kernels);
+  setupBox<2>(kernels);
+  setupBox<4>(kernels);
+  setupBox<8>(kernels);
+}
+
+static struct ResampleKernels
+selectKernels (void)
+{
+  struct ResampleKernels kernels;
+  int level = detectISA();
+
+  setupResampleKernelsScalar(&kernels);
+#ifdef HAVE_X86_KERNELS
+  // Each level starts from the one below so that kernels missing from a
+  // wider instruction set fall back to the narrower version.
+  if (level >= isa_sse2)
+    setupResampleKernelsSSE2(&kernels);
+  if (level >= isa_avx2)
+    setupResampleKernelsAVX2(&kernels);
+  if (level >= isa_avx512)
+    setupResampleKernelsAVX512(&kernels);
+#else
+  (void) level;
+#endif
+
+  return kernels;
+}
+
+const struct ResampleKernels *
+getResampleKernels (void)
+{
+  static const struct ResampleKernels kernels = selectKernels();
+  return &kernels;
+}
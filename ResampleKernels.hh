@@ -0,0 +1,231 @@
+#ifndef __RESAMPLEKERNELS_HH__
+#define __RESAMPLEKERNELS_HH__
+
+// Vectorized row kernels, compiled once per instruction set and selected
+// at run time for the host CPU. This header is included by translation
+// units built with -mavx2 etc. and must not pull in C++ library code:
+// inline functions instantiated there could replace the generic ones at
+// link time and fault on older CPUs.
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+
+// Horizontal pass over one row of nComps interleaved samples:
+//   out[i * nComps + c] = scale * sum_j in[(start[i] + j) * nComps + c] *
+//                                         weights[i * taps + j]
+// for 0 <= i < width. All taps of a window are inside the source row.
+typedef void (*ConvolveRowX)(float *out, const void *in, int32_t width,
+                             const int32_t *start, const float *weights,
+                             int32_t taps, float scale);
+
+// Vertical pass for one output row of n samples, taken from float rows:
+//   out[k] = scale * sum_j rows[j][k] * weights[j]
+// converted to the output sample type with rounding and clamping.
+typedef void (*ConvolveRowY)(void *out, const float *const *rows,
+                             const float *weights, int32_t taps,
+                             int32_t n, float scale);
+
+// Vertical pass straight from source rows of any sample type, when it
+// comes first or alone:
+//   out[k] = scale * sum_j rows[j][k] * weights[j]
+typedef void (*ConvolveRowYSource)(float *out, const void *const *rows,
+                                   const float *weights, int32_t taps,
+                                   int32_t n, float scale);
+
+// Fixed point path for 8 bpc samples. Weights are int16_t with
+// FIXED_WEIGHT_BITS fractional bits; the intermediate rows are int16_t in
+// units of 2^-FIXED_FRAC_BITS of an 8 bit sample, leaving room for filter
+// overshoot. Accumulators are int32_t.
+#define FIXED_WEIGHT_BITS 14
+#define FIXED_FRAC_BITS   6
+#define FIXED_X_SHIFT     (FIXED_WEIGHT_BITS - FIXED_FRAC_BITS)
+#define FIXED_Y_SHIFT     (FIXED_WEIGHT_BITS + FIXED_FRAC_BITS)
+
+// Horizontal pass as ConvolveRowX, rounded to the intermediate:
+//   out[i * nComps + c] = sum_j in[...] * weights[i * taps + j] >> FIXED_X_SHIFT
+typedef void (*ConvolveRowXFixed)(int16_t *out, const uint8_t *in,
+                                  int32_t width, const int32_t *start,
+                                  const int16_t *weights, int32_t taps);
+
+// Vertical pass as ConvolveRowY, rounded and clamped to 8 bits:
+//   out[k] = sum_j rows[j][k] * weights[j] >> FIXED_Y_SHIFT
+typedef void (*ConvolveRowYFixed)(uint8_t *out, const int16_t *const *rows,
+                                  const int16_t *weights, int32_t taps,
+                                  int32_t n);
+
+// Integer box reduction ahead of the filter, a block of ky rows of kx
+// pixels to one. Rows of n samples are summed first:
+//   acc[k] += in[k]
+// then neighbouring pixels of the sums, nComps interleaved samples each:
+//   out[i * nComps + c] = scale * sum_j acc[(i * kx + j) * nComps + c]
+// for 0 <= i < width, rounded and clamped to the output sample type.
+typedef void (*BoxRowY)(float *acc, const void *in, int32_t n);
+typedef void (*BoxRowX)(void *out, const float *acc, int32_t width,
+                        int32_t kx, float scale);
+
+enum sample_type_e
+{
+  sample_uint8 = 0,
+  sample_uint16,
+  sample_float,
+  NUM_SAMPLE_TYPES
+};
+
+// Kernels are also compiled for windows of exactly 4, 8, 12 and 16 taps,
+// the counts most plans have, with every tap loop unrolled. Tap class c
+// holds those for 4 * c taps; class 0 takes any count.
+#define TAP_CLASS_STEP  4
+#define NUM_TAP_CLASSES 5
+
+static inline int
+tapClass (int32_t taps)
+{
+  return taps % TAP_CLASS_STEP == 0 &&
+         taps < NUM_TAP_CLASSES * TAP_CLASS_STEP ? taps / TAP_CLASS_STEP : 0;
+}
+
+// Box kernels are compiled for factors 2, 4 and 8 too; box class 0 takes
+// any factor.
+#define NUM_BOX_CLASSES 4
+
+static inline int
+boxClass (int32_t kx)
+{
+  return kx == 2 ? 1 : kx == 4 ? 2 : kx == 8 ? 3 : 0;
+}
+
+struct ResampleKernels
+{
+  const char  *name; // instruction set
+  // Indexed by tap class, source sample type and nComps - 1.
+  ConvolveRowX convolveX[NUM_TAP_CLASSES][NUM_SAMPLE_TYPES][4];
+  // Indexed by tap class and output sample type.
+  ConvolveRowY convolveY[NUM_TAP_CLASSES][NUM_SAMPLE_TYPES];
+  // Indexed by tap class and source sample type.
+  ConvolveRowYSource convolveYSource[NUM_TAP_CLASSES][NUM_SAMPLE_TYPES];
+  // Fixed point 8 bpc kernels, indexed by tap class and nComps - 1.
+  ConvolveRowXFixed convolveXFixed[NUM_TAP_CLASSES][4];
+  ConvolveRowYFixed convolveYFixed[NUM_TAP_CLASSES];
+  // Indexed by source sample type.
+  BoxRowY      boxY[NUM_SAMPLE_TYPES];
+  // Indexed by box class, output sample type and nComps - 1.
+  BoxRowX      boxX[NUM_BOX_CLASSES][NUM_SAMPLE_TYPES][4];
+};
+
+// Sample type of 8, 16 and 32 (float) bits per component.
+static inline int
+sampleType (int bpc)
+{
+  return bpc == 8 ? sample_uint8 : bpc == 16 ? sample_uint16 : sample_float;
+}
+
+// Full scale value of a sample; float samples are normalized.
+static inline float
+sampleMaxValue (int bpc)
+{
+  return bpc == 8 ? 255.0f : bpc == 16 ? 65535.0f : 1.0f;
+}
+
+// Round 0 <= v < 2^22 in the current mode, to nearest even by default,
+// as the vector conversions do: adding 1.5 * 2^23 leaves no fraction bits.
+// lrintf() would do the same, but is a call while it may set errno.
+static inline float
+roundSample (float v)
+{
+#if FLT_EVAL_METHOD == 0
+  return (v + 12582912.0f) - 12582912.0f;
+#else
+  return (float) lrintf(v);
+#endif
+}
+
+// Scalar conversion matching the vector kernels, for remainders.
+static inline uint8_t
+clampToUint8 (float v)
+{
+  return v <= 0.0f ? 0 : v >= 255.0f ? 255 : (uint8_t) roundSample(v);
+}
+
+static inline uint16_t
+clampToUint16 (float v)
+{
+  return v <= 0.0f ? 0 : v >= 65535.0f ? 65535 : (uint16_t) roundSample(v);
+}
+
+// Fixed point accumulators to the intermediate and to 8 bits.
+static inline int16_t
+fixedToInt16 (int32_t acc)
+{
+  acc = (acc + (1 << (FIXED_X_SHIFT - 1))) >> FIXED_X_SHIFT;
+  return acc < -32768 ? -32768 : acc > 32767 ? 32767 : (int16_t) acc;
+}
+
+static inline uint8_t
+fixedToUint8 (int32_t acc)
+{
+  acc = (acc + (1 << (FIXED_Y_SHIFT - 1))) >> FIXED_Y_SHIFT;
+  return acc < 0 ? 0 : acc > 255 ? 255 : (uint8_t) acc;
+}
+
+// Kernels for the best instruction set of the host CPU, detected on first
+// use. The environment variable RESAMPLE_ISA (scalar, sse2, avx2, avx512)
+// may lower the choice, e.g. to compare results.
+const struct ResampleKernels *getResampleKernels(void);
+
+// Kernels for a window of taps taps: the specialization for the count if
+// there is one, the generic kernel otherwise.
+static inline ConvolveRowX
+selectConvolveX (const struct ResampleKernels *kernels,
+                 int bpc, int nComps, int32_t taps)
+{
+  return kernels->convolveX[tapClass(taps)][sampleType(bpc)][nComps - 1];
+}
+
+static inline ConvolveRowY
+selectConvolveY (const struct ResampleKernels *kernels, int bpc, int32_t taps)
+{
+  return kernels->convolveY[tapClass(taps)][sampleType(bpc)];
+}
+
+static inline ConvolveRowYSource
+selectConvolveYSource (const struct ResampleKernels *kernels,
+                       int bpc, int32_t taps)
+{
+  return kernels->convolveYSource[tapClass(taps)][sampleType(bpc)];
+}
+
+static inline ConvolveRowXFixed
+selectConvolveXFixed (const struct ResampleKernels *kernels,
+                      int nComps, int32_t taps)
+{
+  return kernels->convolveXFixed[tapClass(taps)][nComps - 1];
+}
+
+static inline ConvolveRowYFixed
+selectConvolveYFixed (const struct ResampleKernels *kernels, int32_t taps)
+{
+  return kernels->convolveYFixed[tapClass(taps)];
+}
+
+static inline BoxRowY
+selectBoxY (const struct ResampleKernels *kernels, int bpc)
+{
+  return kernels->boxY[sampleType(bpc)];
+}
+
+static inline BoxRowX
+selectBoxX (const struct ResampleKernels *kernels,
+            int bpc, int nComps, int32_t kx)
+{
+  return kernels->boxX[boxClass(kx)][sampleType(bpc)][nComps - 1];
+}
+
+// Fill in kernels of one instruction set, every tap class of them; the
+// CPU must support it. The scalar set fills every slot.
+void setupResampleKernelsScalar(struct ResampleKernels *kernels);
+void setupResampleKernelsSSE2  (struct ResampleKernels *kernels);
+void setupResampleKernelsAVX2  (struct ResampleKernels *kernels);
+void setupResampleKernelsAVX512(struct ResampleKernels *kernels);
+
+#endif // __RESAMPLEKERNELS_HH__
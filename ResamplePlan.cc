@@ -0,0 +1,493 @@
+// Based on public domain code by Dale Schumacher
+// THIS FILE IS IN THE PUBLIC DOMAIN
+
+#include <math.h>
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "AlignedAlloc.hh"
+#include "ResampleKernels.hh"
+#include "ResamplePlan.hh"
+
+// Contributor table
+ContribTable::ContribTable ()
+{
+  size  = taps = 0;
+  start = NULL;
+  weight = NULL;
+  fixedWeight = NULL;
+  block = NULL;
+}
+
+ContribTable::~ContribTable ()
+{
+  aligned_free(block);
+}
+
+void
+ContribTable::reset (int32_t size, int32_t taps)
+{
+  // Start offsets first, then float and fixed point weights, each on the
+  // next aligned boundary.
+  size_t startBytes = (size * sizeof(int32_t) + ALIGNED_ALLOC_ALIGN - 1) /
+                       ALIGNED_ALLOC_ALIGN * ALIGNED_ALLOC_ALIGN;
+  size_t weightBytes = ((size_t) size * taps * sizeof(float) +
+                        ALIGNED_ALLOC_ALIGN - 1) /
+                        ALIGNED_ALLOC_ALIGN * ALIGNED_ALLOC_ALIGN;
+
+  aligned_free(block);
+  this->size = size;
+  this->taps = taps;
+  block  = aligned_malloc(startBytes + weightBytes +
+                          (size_t) size * taps * sizeof(int16_t));
+  start  = static_cast<int32_t *>(block);
+  weight = reinterpret_cast<float *>(static_cast<char *>(block) + startBytes);
+  fixedWeight = reinterpret_cast<int16_t *>(static_cast<char *>(block) +
+                                            startBytes + weightBytes);
+}
+
+int32_t
+ContribTable::paddedTaps (int32_t taps, int32_t boundary)
+{
+  taps = (taps + TAP_ALIGN - 1) / TAP_ALIGN * TAP_ALIGN;
+  return taps < boundary ? taps : boundary;
+}
+
+int32_t
+ContribTable::getSpan () const
+{
+  // A source pixel may be dropped once no later window starts before it.
+  int32_t span = taps, low = 0;
+
+  for (int32_t i = size - 1; i >= 0; i--) {
+    if (i == size - 1 || start[i] < low)
+      low = start[i];
+    if (start[i] + taps - low > span)
+      span = start[i] + taps - low;
+  }
+  return span;
+}
+
+void
+ContribTable::trim (int32_t boundary)
+{
+  int32_t width = 1;
+
+  for (int32_t i = 0; i < size; i++) {
+    const float *w = getWeights(i);
+    int32_t lo = 0, hi = taps - 1;
+    while (lo < hi && w[lo] == 0.0)
+      lo++;
+    while (hi > lo && w[hi] == 0.0)
+      hi--;
+    if (hi - lo + 1 > width)
+      width = hi - lo + 1;
+  }
+
+  int32_t newTaps = paddedTaps(width, boundary);
+  if (newTaps >= taps)
+    return;
+
+  // New windows are never left of the old ones and rows only move towards
+  // the beginning, so copying forward does not overwrite unread weights.
+  for (int32_t i = 0; i < size; i++) {
+    const float *w = getWeights(i);
+    int32_t lo = 0;
+    while (lo < taps - 1 && w[lo] == 0.0)
+      lo++;
+    int32_t newStart = start[i] + lo;
+    if (newStart > boundary - newTaps)
+      newStart = boundary - newTaps;
+    int32_t shift = newStart - start[i];
+    float  *out   = weight + i * newTaps;
+    for (int32_t j = 0; j < newTaps; j++)
+      out[j] = (shift + j < taps) ? w[shift + j] : 0.0;
+    start[i] = newStart;
+  }
+  taps = newTaps;
+}
+
+void
+ContribTable::quantize ()
+{
+  const float one = 1 << FIXED_WEIGHT_BITS;
+
+  for (int32_t i = 0; i < size; i++) {
+    const float *w = getWeights(i);
+    int16_t     *q = fixedWeight + i * taps;
+    // Rounding error of the sum goes to the largest weight, so that flat
+    // areas come out exactly.
+    float   total = 0.0;
+    int32_t sum = 0, largest = 0;
+    for (int32_t j = 0; j < taps; j++) {
+      q[j]   = (int16_t) lrintf(w[j] * one);
+      total += w[j];
+      sum   += q[j];
+      if (fabsf(w[j]) > fabsf(w[largest]))
+        largest = j;
+    }
+    q[largest] += (int16_t) (lrintf(total * one) - sum);
+  }
+}
+
+// Filter table
+FilterTable::FilterTable (const struct filterItem& filter) :
+  filter(filter)
+{
+  tabulated = filter.support >= 1.0;
+  limit     = filter.support * FILTER_TABLE_STEPS;
+  if (!tabulated)
+    return;
+  // One more entry than the support reaches, for the interpolation.
+  int32_t size = (int32_t) ceil(limit) + 1;
+  values.resize(size);
+  for (int32_t i = 0; i < size; i++)
+    values[i] = (*filter.func)((float) i / FILTER_TABLE_STEPS,
+                               filter.b, filter.c);
+}
+
+std::shared_ptr<const FilterTable>
+FilterTable::get (const struct filterItem& filter)
+{
+  static std::mutex lock;
+  static std::map<std::string, std::shared_ptr<const FilterTable> > tables;
+
+  std::lock_guard<std::mutex> guard(lock);
+  std::shared_ptr<const FilterTable>& table = tables[filter.name];
+  if (!table)
+    table = std::make_shared<const FilterTable>(filter);
+  return table;
+}
+
+// Plan
+ResamplePlan::ResamplePlan (const struct filterItem& filter,
+                            int32_t srcWidth, int32_t srcHeight,
+                            int32_t dstWidth, int32_t dstHeight,
+                            bool shrink)
+{
+  this->filterName = filter.name;
+  this->srcWidth   = srcWidth;
+  this->srcHeight  = srcHeight;
+  this->dstWidth   = dstWidth;
+  this->dstHeight  = dstHeight;
+  // The window of a filter narrower than a pixel (Box) has edges that
+  // would move to whole boxes.
+  if (filter.support < 1.0)
+    shrink = false;
+  boxX = shrink ? boxFactor(srcWidth,  dstWidth)  : 1;
+  boxY = shrink ? boxFactor(srcHeight, dstHeight) : 1;
+
+  setupContributor(contributorX, filter, dstWidth,  srcWidth  / boxX, boxX);
+  setupContributor(contributorY, filter, dstHeight, srcHeight / boxY, boxY);
+
+  if (dstWidth == srcWidth)
+    passes = dstHeight == srcHeight ? passes_none : passes_y;
+  else if (dstHeight == srcHeight)
+    passes = passes_x;
+  else
+    passes = getCost(true) < getCost(false) ? passes_yx : passes_xy;
+}
+
+// Each pass makes its output samples, taps each; the first of two runs
+// over the rows, or the columns, of the source after the box reduction.
+double
+ResamplePlan::getCost (bool yFirst) const
+{
+  double width  = srcWidth / boxX;
+  double height = srcHeight / boxY;
+  double tapX   = contributorX.getTaps() * PASS_COST_TAP_X + PASS_COST_SAMPLE;
+  double tapY   = contributorY.getTaps() + PASS_COST_SAMPLE;
+  double costX  = dstWidth != srcWidth ? dstWidth * tapX : 0.0;
+  double costY  = dstHeight != srcHeight ? dstHeight * tapY : 0.0;
+
+  if (yFirst)
+    return costY * width + costX * dstHeight;
+  return costX * height + costY * dstWidth;
+}
+
+const char *
+ResamplePlan::getPassesName (enum resample_passes_e passes)
+{
+  switch (passes) {
+  case passes_x:  return "x";
+  case passes_y:  return "y";
+  case passes_xy: return "xy";
+  case passes_yx: return "yx";
+  default:        return "none";
+  }
+}
+
+int32_t
+ResamplePlan::boxFactor (int32_t srcSize, int32_t dstSize)
+{
+  if (dstSize <= 0)
+    return 1;
+  for (int32_t box = srcSize / (dstSize * BOX_MIN_RATIO); box > 1; box--) {
+    if (srcSize % box == 0)
+      return box;
+  }
+  return 1;
+}
+
+// After a box reduction by box, reduced pixel p is the mean of source
+// pixels box * p to box * p + box - 1.
+void
+ResamplePlan::setupContributor (ContribTable& contributor,
+                                const struct filterItem& filter,
+                                int32_t dstSize, int32_t srcSize, int32_t box)
+{
+  float scale = (float) dstSize / (float) srcSize;
+
+  if (scale < 1.0)
+    setupContributorForDownsample(contributor, filter, scale, dstSize,
+                                  srcSize, box);
+  else
+    setupContributorForUpsample  (contributor, filter,
+                                  scale, dstSize, srcSize);
+  contributor.trim(srcSize);
+  contributor.quantize();
+}
+
+// Reflect at boundary, then periodic for what reflection could not bring
+// into range.
+static inline int32_t
+reflectIndex (int32_t j, int32_t boundary)
+{
+  int32_t n = j;
+  if (j < 0) {
+    n = - j; // or periodic: dstSize - j
+  } else if (j >= boundary) {
+    n = (boundary - j) + boundary - 1; // j - boundary
+  }
+  while (n < 0)
+    n += boundary;
+  while (n >= boundary)
+    n -= boundary;
+  return n;
+}
+
+// Leftmost source pixel of a window of taps pixels that holds every
+// source pixel reached from left to right.
+static inline int32_t
+windowStart (int32_t left, int32_t right, int32_t boundary, int32_t taps)
+{
+  int32_t lo = boundary;
+  for (int32_t j = left; j <= right; j++) {
+    int32_t n = reflectIndex(j, boundary);
+    if (n < lo)
+      lo = n;
+  }
+  return lo < boundary - taps ? lo : boundary - taps;
+}
+
+// Calculate how much sorrounding pixels contribute. After a box reduction
+// the weights of the direct path, over the source pixels, are summed over
+// each box: the result is that of the direct path wherever the pixels of
+// a box are alike, edges included.
+void
+ResamplePlan::setupContributorForDownsample (ContribTable& contributor,
+                                             const struct filterItem& filter,
+                                             float   scale,
+                                             int32_t dstSize,
+                                             int32_t boundary,
+                                             int32_t box)
+{
+  const FilterTable& filter_fn = *FilterTable::get(filter);
+  // In source pixels.
+  int32_t srcSize     = boundary * box;
+  float   srcScale    = scale / box;
+  float   supportSize = filter.support / srcScale;
+  int32_t taps = ContribTable::paddedTaps((int32_t) (supportSize * 2 / box) + 3,
+                                          boundary);
+  std::vector<float> values;
+
+  contributor.reset(dstSize, taps);
+
+  for (int32_t i = 0; i < dstSize; i++) {
+    float center = (float) i / srcScale;
+    float left   = ceil (center - supportSize);
+    float right  = floor(center + supportSize);
+    float total  = 0.0; // Normalization required
+    values.clear();
+    for (int32_t k = left; k <= right; k++) {
+      values.push_back(filter_fn((center - k) * srcScale));
+      total += values.back();
+    }
+    int32_t lo = boundary;
+    for (int32_t j = left; j <= right; j++)
+      lo = std::min(lo, reflectIndex(j, srcSize) / box);
+    int32_t start = lo < boundary - taps ? lo : boundary - taps;
+    float  *w     = contributor.getWeights(i);
+    for (int32_t j = 0; j < taps; j++)
+      w[j] = 0.0;
+    for (int32_t j = left; j <= right; j++) {
+      int32_t n = reflectIndex(j, srcSize) / box;
+      w[n - start] += values[j - (int32_t) left] / total;
+    }
+    contributor.getStart()[i] = start; // position of first contributor
+  }
+}
+
+void
+ResamplePlan::setupContributorForUpsample (ContribTable& contributor,
+                                           const struct filterItem& filter,
+                                           float   scale,
+                                           int32_t dstSize,
+                                           int32_t boundary)
+{
+  const FilterTable& filter_fn = *FilterTable::get(filter);
+  float support = filter.support;
+  int32_t taps  = ContribTable::paddedTaps((int32_t) (support * 2) + 2,
+                                           boundary);
+  std::vector<float> values;
+
+  contributor.reset(dstSize, taps);
+
+  for (int32_t i = 0; i < dstSize; i++) {
+    float center = (float) i / scale;
+    float left   = ceil (center - support);
+    float right  = floor(center + support);
+    // Normalized too, so that flat areas stay flat: at whole pixels the
+    // Lanczos filters sum to 1 only within 0.6% (3 lobes) to 1.9% (2),
+    // the Gaussian to 1.25.
+    float total  = 0.0;
+    values.clear();
+    for (int32_t k = left; k <= right; k++) {
+      values.push_back(filter_fn(center - k));
+      total += values.back();
+    }
+    int32_t start = windowStart(left, right, boundary, taps);
+    float  *w     = contributor.getWeights(i);
+    for (int32_t j = 0; j < taps; j++)
+      w[j] = 0.0;
+    for (int32_t j = left; j <= right; j++) {
+      float weight = values[j - (int32_t) left] / total;
+      w[reflectIndex(j, boundary) - start] += weight;
+    }
+    contributor.getStart()[i] = start;
+  }
+}
+
+// Plan cache
+bool
+ResamplePlanCache::Key::operator< (const Key& other) const
+{
+  if (filter != other.filter)
+    return filter < other.filter;
+  if (srcWidth != other.srcWidth)
+    return srcWidth < other.srcWidth;
+  if (srcHeight != other.srcHeight)
+    return srcHeight < other.srcHeight;
+  if (dstWidth != other.dstWidth)
+    return dstWidth < other.dstWidth;
+  if (dstHeight != other.dstHeight)
+    return dstHeight < other.dstHeight;
+  return shrink < other.shrink;
+}
+
+ResamplePlanCache::ResamplePlanCache (size_t capacity)
+{
+  this->capacity = capacity;
+  hits = misses = 0;
+}
+
+std::shared_ptr<const ResamplePlan>
+ResamplePlanCache::get (const struct filterItem& filter,
+                        int32_t srcWidth, int32_t srcHeight,
+                        int32_t dstWidth, int32_t dstHeight, bool shrink)
+{
+  Key key = { filter.name, srcWidth, srcHeight, dstWidth, dstHeight, shrink };
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<Key, std::list<Entry>::iterator>::iterator found =
+        index.find(key);
+    if (found != index.end()) {
+      hits++;
+      entries.splice(entries.begin(), entries, found->second);
+      return found->second->second;
+    }
+    misses++;
+  }
+
+  // Build outside of the lock; concurrent misses for the same key may
+  // build the same plan twice, but only one of them is kept.
+  std::shared_ptr<const ResamplePlan> plan =
+      std::make_shared<const ResamplePlan>(filter, srcWidth, srcHeight,
+                                           dstWidth, dstHeight, shrink);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (capacity == 0)
+    return plan;
+  std::map<Key, std::list<Entry>::iterator>::iterator found = index.find(key);
+  if (found != index.end()) {
+    entries.splice(entries.begin(), entries, found->second);
+    return found->second->second;
+  }
+  entries.push_front(Entry(key, plan));
+  index[key] = entries.begin();
+  evict();
+
+  return plan;
+}
+
+size_t
+ResamplePlanCache::getCapacity () const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return capacity;
+}
+
+void
+ResamplePlanCache::setCapacity (size_t capacity)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  this->capacity = capacity;
+  evict();
+}
+
+void
+ResamplePlanCache::clear ()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  index.clear();
+  entries.clear();
+}
+
+size_t
+ResamplePlanCache::getHits () const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return hits;
+}
+
+size_t
+ResamplePlanCache::getMisses () const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return misses;
+}
+
+// Drop least recently used plans; caller holds the lock. Plans still in
+// use elsewhere stay alive through their shared_ptr.
+void
+ResamplePlanCache::evict ()
+{
+  while (entries.size() > capacity) {
+    index.erase(entries.back().first);
+    entries.pop_back();
+  }
+}
+
+ResamplePlanCache&
+ResamplePlanCache::shared ()
+{
+  static ResamplePlanCache cache;
+  return cache;
+}
@@ -0,0 +1,249 @@
+// Based on public domain code by Dale Schumacher
+// THIS FILE IS IN THE PUBLIC DOMAIN
+
+#ifndef __RESAMPLEPLAN_HH__
+#define __RESAMPLEPLAN_HH__
+
+#include <math.h>
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Tap counts are padded to a multiple of this.
+#define TAP_ALIGN 4
+
+// Contributors of every output pixel along one axis, stored in a single
+// allocation. Output pixel i is the weighted sum of the taps source pixels
+// start[i], start[i] + 1, ..., start[i] + taps - 1 with the weights
+// weights(i)[0 .. taps - 1]. Reflection at the boundary is folded into the
+// weights and padding taps have zero weight; the window of taps never goes
+// past the source, so kernels can read every tap unconditionally.
+class ContribTable
+{
+public:
+  ContribTable();
+  ~ContribTable();
+
+  int32_t getSize() const { return size; };
+  int32_t getTaps() const { return taps; };
+
+  const int32_t *getStart() const { return start; };
+  const float   *getWeights() const { return weight; };
+  int32_t        getStart(int32_t i) const { return start[i]; };
+  const float   *getWeights(int32_t i) const { return weight + i * taps; };
+  // The same weights in fixed point, FIXED_WEIGHT_BITS fractional bits.
+  const int16_t *getFixedWeights() const { return fixedWeight; };
+  const int16_t *getFixedWeights(int32_t i) const
+      { return fixedWeight + i * taps; };
+
+  // Number of consecutive source pixels that must be at hand to produce
+  // the outputs in order, each source pixel being read once.
+  int32_t getSpan() const;
+
+  // Allocate for size output pixels of taps (padded) taps each.
+  void reset(int32_t size, int32_t taps);
+  int32_t *getStart() { return start; };
+  float   *getWeights() { return weight; };
+  float   *getWeights(int32_t i) { return weight + i * taps; };
+  // Drop zero weight taps at both ends of every window, in place.
+  void trim(int32_t boundary);
+  // Derive the fixed point weights, once the float ones are final.
+  void quantize();
+
+  // Tap count padded for a window of width taps within a source of
+  // boundary pixels.
+  static int32_t paddedTaps(int32_t taps, int32_t boundary);
+
+private:
+  ContribTable(const ContribTable&);
+  ContribTable& operator=(const ContribTable&);
+
+  int32_t  size;
+  int32_t  taps;
+  int32_t *start;
+  float   *weight;
+  int16_t *fixedWeight;
+  void    *block;
+};
+
+// A filter of a family: func(t, b, c) with the parameters b and c of the
+// family, zero for |t| >= support.
+struct filterItem
+{
+  const char name[32];
+  float (*func)(float t, float b, float c);
+  float support;
+  float b, c;
+};
+
+// Filters are sampled this many times per unit of t over their support
+// and looked up with linear interpolation, within 7e-7 of the function
+// for the filters of Resampler.
+#define FILTER_TABLE_STEPS 1024
+
+// A filter tabulated for the contributor setup, which would otherwise
+// call its function (two sin() for Lanczos) for every tap of every output
+// pixel. Filters are taken as even functions. Filters narrower than a
+// pixel (Box) have edges that the interpolation would smear, and are
+// evaluated directly.
+class FilterTable
+{
+public:
+  FilterTable(const struct filterItem& filter);
+
+  float operator() (float t) const
+  {
+    if (!tabulated)
+      return (*filter.func)(t, filter.b, filter.c);
+    float x = fabsf(t) * FILTER_TABLE_STEPS;
+    if (!(x < limit))
+      return 0.0f;
+    int32_t i = (int32_t) x;
+    return values[i] + (x - i) * (values[i + 1] - values[i]);
+  };
+
+  // The table of filter, made on first use. Filters are told apart by
+  // name.
+  static std::shared_ptr<const FilterTable> get(const struct filterItem& filter);
+
+private:
+  struct filterItem  filter;
+  bool               tabulated;
+  float              limit;   // support in steps
+  std::vector<float> values;  // at 0, 1 / FILTER_TABLE_STEPS, ...
+};
+
+// Large reductions may start with an integer box reduction, leaving the
+// filter at least this ratio, so that boxes stay within a third of an
+// output pixel. The box weights are those of the filter summed over the
+// box, so results are the filter's wherever the pixels of a box are
+// alike; otherwise they differ by the variation of the filter over the
+// box, not bounded by any ratio. On noise and sharp edges that is up to
+// 28/255 of full scale, up to 7/255 on average, so it is opt-in.
+#define BOX_MIN_RATIO 3
+
+// Filter passes of a resampling, in the order they run. An axis whose
+// size does not change needs no pass.
+enum resample_passes_e
+{
+  passes_none = 0,
+  passes_x,
+  passes_y,
+  passes_xy,  // horizontal first, into dstWidth x srcHeight
+  passes_yx   // vertical first, into srcWidth x dstHeight
+};
+
+// Costs of a pass per output sample, in taps of the vertical pass: a tap
+// of the horizontal pass, which gathers its taps along the row, and
+// writing the sample out to be read again.
+#define PASS_COST_TAP_X  2.0
+#define PASS_COST_SAMPLE 2.0
+
+// Contributor tables for both axes of a resampling from one image size
+// to another with a given filter. A plan is never modified after it is
+// built, so it can be shared between threads and reused for any number
+// of images of the same size.
+class ResamplePlan
+{
+public:
+  ResamplePlan(const struct filterItem& filter,
+               int32_t srcWidth, int32_t srcHeight,
+               int32_t dstWidth, int32_t dstHeight, bool shrink = false);
+
+  const std::string& getFilterName() const { return filterName; };
+  int32_t getSrcWidth()  const { return srcWidth; };
+  int32_t getSrcHeight() const { return srcHeight; };
+  int32_t getDstWidth()  const { return dstWidth; };
+  int32_t getDstHeight() const { return dstHeight; };
+
+  // Source pixels averaged into one before the filter runs, 1 for none.
+  // The contributor tables are then for a source of srcWidth / boxX by
+  // srcHeight / boxY pixels.
+  int32_t getBoxX() const { return boxX; };
+  int32_t getBoxY() const { return boxY; };
+
+  const ContribTable& getContributorX() const { return contributorX; };
+  const ContribTable& getContributorY() const { return contributorY; };
+
+  // Estimated work of the passes of both axes, the vertical one first or
+  // not, per channel in taps of the vertical pass; see PASS_COST_TAP_X.
+  double getCost(bool yFirst) const;
+  // The passes to run: none along an axis that needs none, and for two
+  // the cheaper order.
+  enum resample_passes_e getPasses() const { return passes; };
+  static const char *getPassesName(enum resample_passes_e passes);
+
+  // Largest factor dividing srcSize that leaves at least BOX_MIN_RATIO
+  // for the filter, 1 if there is none.
+  static int32_t boxFactor(int32_t srcSize, int32_t dstSize);
+
+private:
+  std::string filterName;
+  int32_t     srcWidth, srcHeight;
+  int32_t     dstWidth, dstHeight;
+  int32_t     boxX, boxY;
+  enum resample_passes_e passes;
+  ContribTable contributorX;
+  ContribTable contributorY;
+
+  static void setupContributor (ContribTable& contributor,
+                                const struct filterItem& filter,
+                                int32_t dstSize, int32_t srcSize,
+                                int32_t box);
+  static void setupContributorForDownsample (ContribTable& contributor,
+                                const struct filterItem& filter, float scale,
+                                int32_t dstSize, int32_t boundary,
+                                int32_t box);
+  static void setupContributorForUpsample   (ContribTable& contributor,
+                                const struct filterItem& filter, float scale,
+                                int32_t dstSize, int32_t boundary);
+};
+
+// Bounded, least recently used cache of plans. All methods are thread-safe.
+class ResamplePlanCache
+{
+public:
+  ResamplePlanCache(size_t capacity = 16);
+
+  // Return a plan from the cache, or build and remember a new one.
+  std::shared_ptr<const ResamplePlan> get(const struct filterItem& filter,
+                                          int32_t srcWidth, int32_t srcHeight,
+                                          int32_t dstWidth, int32_t dstHeight,
+                                          bool shrink = false);
+
+  size_t getCapacity() const;
+  void   setCapacity(size_t capacity);
+  void   clear();
+
+  size_t getHits()   const;
+  size_t getMisses() const;
+
+  // Cache shared by all Resampler instances unless told otherwise.
+  static ResamplePlanCache& shared();
+
+private:
+  struct Key
+  {
+    std::string filter;
+    int32_t     srcWidth, srcHeight, dstWidth, dstHeight;
+    bool        shrink;
+    bool operator< (const Key& other) const;
+  };
+  typedef std::pair<Key, std::shared_ptr<const ResamplePlan> > Entry;
+
+  mutable std::mutex mutex;
+  size_t capacity;
+  size_t hits, misses;
+  // Most recently used first.
+  std::list<Entry> entries;
+  std::map<Key, std::list<Entry>::iterator> index;
+
+  void evict();
+};
+
+#endif // __RESAMPLEPLAN_HH__
@@ -0,0 +1,585 @@
+// SSE2 row kernels, see ResampleKernels.hh.
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <string.h>
+#include <emmintrin.h>
+
+#include "ResampleKernels.hh"
+
+namespace {
+
+// Load four samples as float.
+template <typename T> inline __m128 load4(const T *p);
+
+template <> inline __m128
+load4<uint8_t> (const uint8_t *p)
+{
+  int32_t v;
+  memcpy(&v, p, sizeof(v));
+  __m128i zero = _mm_setzero_si128();
+  __m128i x    = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero);
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(x, zero));
+}
+
+template <> inline __m128
+load4<uint16_t> (const uint16_t *p)
+{
+  __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(x, _mm_setzero_si128()));
+}
+
+template <> inline __m128
+load4<float> (const float *p)
+{
+  return _mm_loadu_ps(p);
+}
+
+// Load three samples, the last lane is zero. Used where reading a fourth
+// sample could go past the end of the row.
+template <typename T> inline __m128
+load3 (const T *p)
+{
+  return _mm_setr_ps(p[0], p[1], p[2], 0.0f);
+}
+
+inline float
+hsum (__m128 v)
+{
+  __m128 t = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+  return _mm_cvtss_f32(t);
+}
+
+// One channel: vectorized over taps.
+template <typename T, int TAPS> void
+convolveX1 (float *out, const void *src, int32_t width,
+            const int32_t *start, const float *weights,
+            int32_t taps, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const T *in = static_cast<const T *>(src);
+
+  for (int32_t i = 0; i < width; i++) {
+    const T     *p = in + start[i];
+    const float *w = weights + i * taps;
+    __m128  acc = _mm_setzero_ps();
+    int32_t j   = 0;
+    for (; j + 4 <= taps; j += 4)
+      acc = _mm_add_ps(acc, _mm_mul_ps(load4<T>(p + j), _mm_loadu_ps(w + j)));
+    float sum = hsum(acc);
+    for (; j < taps; j++)
+      sum += p[j] * w[j];
+    out[i] = sum * scale;
+  }
+}
+
+// Two channels: two taps per vector.
+template <typename T, int TAPS> void
+convolveX2 (float *out, const void *src, int32_t width,
+            const int32_t *start, const float *weights,
+            int32_t taps, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const T *in = static_cast<const T *>(src);
+
+  for (int32_t i = 0; i < width; i++) {
+    const T     *p = in + 2 * start[i];
+    const float *w = weights + i * taps;
+    __m128  acc = _mm_setzero_ps();
+    int32_t j   = 0;
+    for (; j + 4 <= taps; j += 4) {
+      __m128 wv = _mm_loadu_ps(w + j);
+      acc = _mm_add_ps(acc, _mm_mul_ps(load4<T>(p + 2 * j),
+                                       _mm_unpacklo_ps(wv, wv)));
+      acc = _mm_add_ps(acc, _mm_mul_ps(load4<T>(p + 2 * j + 4),
+                                       _mm_unpackhi_ps(wv, wv)));
+    }
+    for (; j + 2 <= taps; j += 2) {
+      __m128 wv = _mm_setr_ps(w[j], w[j], w[j + 1], w[j + 1]);
+      acc = _mm_add_ps(acc, _mm_mul_ps(load4<T>(p + 2 * j), wv));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    if (j < taps)
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_setr_ps(p[2 * j], p[2 * j + 1],
+                                                   0.0f, 0.0f),
+                                       _mm_set1_ps(w[j])));
+    acc = _mm_mul_ps(acc, _mm_set1_ps(scale));
+    _mm_storel_pi(reinterpret_cast<__m64 *>(out + 2 * i), acc);
+  }
+}
+
+// Three channels: one tap per vector, the fourth lane is ignored.
+template <typename T, int TAPS> void
+convolveX3 (float *out, const void *src, int32_t width,
+            const int32_t *start, const float *weights,
+            int32_t taps, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const T *in = static_cast<const T *>(src);
+
+  for (int32_t i = 0; i < width; i++) {
+    const T     *p = in + 3 * start[i];
+    const float *w = weights + i * taps;
+    __m128  acc = _mm_setzero_ps();
+    int32_t j   = 0;
+    // The sample after a tap belongs to the next tap of the window.
+    for (; j + 1 < taps; j++)
+      acc = _mm_add_ps(acc, _mm_mul_ps(load4<T>(p + 3 * j),
+                                       _mm_set1_ps(w[j])));
+    acc = _mm_add_ps(acc, _mm_mul_ps(load3<T>(p + 3 * j), _mm_set1_ps(w[j])));
+    acc = _mm_mul_ps(acc, _mm_set1_ps(scale));
+    if (i + 1 < width) {
+      // The fourth lane is overwritten by the next pixel.
+      _mm_storeu_ps(out + 3 * i, acc);
+    } else {
+      float v[4];
+      _mm_storeu_ps(v, acc);
+      out[3 * i] = v[0]; out[3 * i + 1] = v[1]; out[3 * i + 2] = v[2];
+    }
+  }
+}
+
+// Four channels: one tap per vector.
+template <typename T, int TAPS> void
+convolveX4 (float *out, const void *src, int32_t width,
+            const int32_t *start, const float *weights,
+            int32_t taps, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const T *in = static_cast<const T *>(src);
+
+  for (int32_t i = 0; i < width; i++) {
+    const T     *p = in + 4 * start[i];
+    const float *w = weights + i * taps;
+    __m128  acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    int32_t j    = 0;
+    for (; j + 2 <= taps; j += 2) {
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(load4<T>(p + 4 * j),
+                                         _mm_set1_ps(w[j])));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(load4<T>(p + 4 * j + 4),
+                                         _mm_set1_ps(w[j + 1])));
+    }
+    if (j < taps)
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(load4<T>(p + 4 * j),
+                                         _mm_set1_ps(w[j])));
+    _mm_storeu_ps(out + 4 * i,
+                  _mm_mul_ps(_mm_add_ps(acc0, acc1), _mm_set1_ps(scale)));
+  }
+}
+
+// Store eight scaled samples, rounded and clamped to the sample type.
+template <typename T> inline void store8(T *p, __m128 a, __m128 b);
+template <typename T> inline T    store1(float v);
+
+template <> inline void
+store8<uint8_t> (uint8_t *p, __m128 a, __m128 b)
+{
+  __m128i x = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(p), _mm_packus_epi16(x, x));
+}
+
+template <> inline void
+store8<uint16_t> (uint16_t *p, __m128 a, __m128 b)
+{
+  // No unsigned 32 to 16 bit pack in SSE2: clamp, then pack with a bias.
+  __m128  lo   = _mm_setzero_ps(), hi = _mm_set1_ps(65535.0f);
+  __m128i bias = _mm_set1_epi32(32768);
+  __m128i x = _mm_sub_epi32(_mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(a, lo), hi)),
+                            bias);
+  __m128i y = _mm_sub_epi32(_mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(b, lo), hi)),
+                            bias);
+  x = _mm_xor_si128(_mm_packs_epi32(x, y), _mm_set1_epi16((short) 0x8000));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(p), x);
+}
+
+template <> inline void
+store8<float> (float *p, __m128 a, __m128 b)
+{
+  _mm_storeu_ps(p, a);
+  _mm_storeu_ps(p + 4, b);
+}
+
+template <> inline uint8_t  store1<uint8_t> (float v) { return clampToUint8(v); }
+template <> inline uint16_t store1<uint16_t>(float v) { return clampToUint16(v); }
+template <> inline float    store1<float>   (float v) { return v; }
+
+// Vertical pass: vectorized along the row.
+template <typename T, int TAPS> void
+convolveY (void *dst, const float *const *rows, const float *weights,
+           int32_t taps, int32_t n, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  T      *out = static_cast<T *>(dst);
+  __m128  s   = _mm_set1_ps(scale);
+  int32_t k   = 0;
+
+  for (; k + 8 <= n; k += 8) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    for (int32_t j = 0; j < taps; j++) {
+      __m128 w = _mm_set1_ps(weights[j]);
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(rows[j] + k), w));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(rows[j] + k + 4), w));
+    }
+    store8<T>(out + k, _mm_mul_ps(acc0, s), _mm_mul_ps(acc1, s));
+  }
+  for (; k < n; k++) {
+    float acc = 0.0f;
+    for (int32_t j = 0; j < taps; j++)
+      acc += rows[j][k] * weights[j];
+    out[k] = store1<T>(acc * scale);
+  }
+}
+
+template <typename T, int TAPS> void
+convolveYSource (float *out, const void *const *src, const float *weights,
+                 int32_t taps, int32_t n, float scale)
+{
+  if (TAPS)
+    taps = TAPS;
+  const T *const *rows = reinterpret_cast<const T *const *>(src);
+  __m128  s = _mm_set1_ps(scale);
+  int32_t k = 0;
+
+  for (; k + 8 <= n; k += 8) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    for (int32_t j = 0; j < taps; j++) {
+      __m128 w = _mm_set1_ps(weights[j]);
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(load4<T>(rows[j] + k), w));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(load4<T>(rows[j] + k + 4), w));
+    }
+    _mm_storeu_ps(out + k,     _mm_mul_ps(acc0, s));
+    _mm_storeu_ps(out + k + 4, _mm_mul_ps(acc1, s));
+  }
+  for (; k < n; k++) {
+    float acc = 0.0f;
+    for (int32_t j = 0; j < taps; j++)
+      acc += rows[j][k] * weights[j];
+    out[k] = acc * scale;
+  }
+}
+
+// Fixed point kernels for 8 bpc samples: samples are widened to 16 bits
+// and pairs of taps multiplied and added with pmaddwd.
+
+inline __m128i
+loadu32 (const void *p)
+{
+  int32_t v;
+  memcpy(&v, p, sizeof(v));
+  return _mm_cvtsi32_si128(v);
+}
+
+// Three samples, the fourth is zero.
+inline __m128i
+loadu24 (const uint8_t *p)
+{
+  return _mm_cvtsi32_si128(p[0] | (p[1] << 8) | (p[2] << 16));
+}
+
+// Two weights w0, w1 repeated in every 32 bit lane.
+inline __m128i
+weightPair (int16_t w0, int16_t w1)
+{
+  return _mm_set1_epi32((uint16_t) w0 | ((uint32_t) (uint16_t) w1 << 16));
+}
+
+inline __m128i
+roundFixedX (__m128i acc)
+{
+  return _mm_srai_epi32(_mm_add_epi32(acc,
+                                      _mm_set1_epi32(1 << (FIXED_X_SHIFT - 1))),
+                        FIXED_X_SHIFT);
+}
+
+template <int TAPS> void
+convolveXFixed1 (int16_t *out, const uint8_t *in, int32_t width,
+                 const int32_t *start, const int16_t *weights, int32_t taps)
+{
+  if (TAPS)
+    taps = TAPS;
+  __m128i zero = _mm_setzero_si128();
+
+  for (int32_t i = 0; i < width; i++) {
+    const uint8_t *p = in + start[i];
+    const int16_t *w = weights + i * taps;
+    __m128i acc = _mm_setzero_si128();
+    int32_t j   = 0;
+    for (; j + 8 <= taps; j += 8) {
+      __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p + j));
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi8(x, zero),
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(w + j))));
+    }
+    for (; j + 4 <= taps; j += 4) {
+      __m128i x = _mm_unpacklo_epi8(loadu32(p + j), zero);
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(x,
+          _mm_loadl_epi64(reinterpret_cast<const __m128i *>(w + j))));
+    }
+    acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+    acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+    int32_t sum = _mm_cvtsi128_si32(acc);
+    for (; j < taps; j++)
+      sum += p[j] * w[j];
+    out[i] = fixedToInt16(sum);
+  }
+}
+
+template <int TAPS> void
+convolveXFixed2 (int16_t *out, const uint8_t *in, int32_t width,
+                 const int32_t *start, const int16_t *weights, int32_t taps)
+{
+  if (TAPS)
+    taps = TAPS;
+  __m128i zero = _mm_setzero_si128();
+
+  for (int32_t i = 0; i < width; i++) {
+    const uint8_t *p = in + 2 * start[i];
+    const int16_t *w = weights + i * taps;
+    __m128i acc = _mm_setzero_si128();
+    int32_t j   = 0;
+    // a0 b0 a1 b1 .. to a0 a1 b0 b1 .., against w0 w1 w0 w1 ..
+    for (; j + 4 <= taps; j += 4) {
+      __m128i x = _mm_unpacklo_epi8(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p + 2 * j)), zero);
+      x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 1, 2, 0));
+      x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(3, 1, 2, 0));
+      __m128i wv = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(w + j));
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(x, _mm_unpacklo_epi32(wv, wv)));
+    }
+    for (; j + 2 <= taps; j += 2) {
+      __m128i x = _mm_unpacklo_epi8(loadu32(p + 2 * j), zero);
+      x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 1, 2, 0));
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(x, weightPair(w[j], w[j + 1])));
+    }
+    acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+    int32_t a = _mm_cvtsi128_si32(acc);
+    int32_t b = _mm_cvtsi128_si32(_mm_srli_si128(acc, 4));
+    if (j < taps) {
+      a += p[2 * j] * w[j];
+      b += p[2 * j + 1] * w[j];
+    }
+    out[2 * i]     = fixedToInt16(a);
+    out[2 * i + 1] = fixedToInt16(b);
+  }
+}
+
+// Three and four channels: two pixels r0 g0 b0 a0 r1 g1 b1 a1 are paired
+// up as r0 r1 g0 g1 b0 b1 a0 a1 against w0 w1 in every lane.
+inline __m128i
+pairPixels (__m128i x)
+{
+  x = _mm_unpacklo_epi8(x, _mm_setzero_si128());
+  return _mm_unpacklo_epi16(x, _mm_srli_si128(x, 8));
+}
+
+template <int TAPS> void
+convolveXFixed3 (int16_t *out, const uint8_t *in, int32_t width,
+                 const int32_t *start, const int16_t *weights, int32_t taps)
+{
+  if (TAPS)
+    taps = TAPS;
+  for (int32_t i = 0; i < width; i++) {
+    const uint8_t *p = in + 3 * start[i];
+    const int16_t *w = weights + i * taps;
+    __m128i acc = _mm_setzero_si128();
+    int32_t j   = 0;
+    // Four bytes are read per pixel; the one after the last tap's pixel
+    // may be past the row.
+    for (; j + 2 < taps; j += 2) {
+      __m128i x = _mm_unpacklo_epi32(loadu32(p + 3 * j),
+                                     loadu32(p + 3 * j + 3));
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(pairPixels(x),
+                                              weightPair(w[j], w[j + 1])));
+    }
+    for (; j < taps; j++)
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(pairPixels(loadu24(p + 3 * j)),
+                                              weightPair(w[j], 0)));
+    __m128i v = roundFixedX(acc);
+    v = _mm_packs_epi32(v, v);
+    if (i + 1 < width) {
+      // The fourth sample is overwritten by the next pixel.
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 3 * i), v);
+    } else {
+      int16_t s[8];
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(s), v);
+      out[3 * i] = s[0]; out[3 * i + 1] = s[1]; out[3 * i + 2] = s[2];
+    }
+  }
+}
+
+template <int TAPS> void
+convolveXFixed4 (int16_t *out, const uint8_t *in, int32_t width,
+                 const int32_t *start, const int16_t *weights, int32_t taps)
+{
+  if (TAPS)
+    taps = TAPS;
+  for (int32_t i = 0; i < width; i++) {
+    const uint8_t *p = in + 4 * start[i];
+    const int16_t *w = weights + i * taps;
+    __m128i acc = _mm_setzero_si128();
+    int32_t j   = 0;
+    for (; j + 2 <= taps; j += 2) {
+      __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p + 4 * j));
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(pairPixels(x),
+                                              weightPair(w[j], w[j + 1])));
+    }
+    if (j < taps)
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(pairPixels(loadu32(p + 4 * j)),
+                                              weightPair(w[j], 0)));
+    __m128i v = roundFixedX(acc);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 4 * i),
+                     _mm_packs_epi32(v, v));
+  }
+}
+
+// Vertical pass: rows are taken in pairs, interleaved and multiplied
+// against a weight pair.
+template <int TAPS> void
+convolveYFixed (uint8_t *out, const int16_t *const *rows,
+                const int16_t *weights, int32_t taps, int32_t n)
+{
+  if (TAPS)
+    taps = TAPS;
+  __m128i round = _mm_set1_epi32(1 << (FIXED_Y_SHIFT - 1));
+  int32_t k     = 0;
+
+  for (; k + 8 <= n; k += 8) {
+    __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    for (int32_t j = 0; j < taps; j += 2) {
+      __m128i r0 = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(rows[j] + k));
+      __m128i r1 = j + 1 < taps ? _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(rows[j + 1] + k)) :
+          _mm_setzero_si128();
+      __m128i wv = weightPair(weights[j], j + 1 < taps ? weights[j + 1] : 0);
+      lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(r0, r1), wv));
+      hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(r0, r1), wv));
+    }
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, round), FIXED_Y_SHIFT);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, round), FIXED_Y_SHIFT);
+    __m128i x = _mm_packs_epi32(lo, hi);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out + k),
+                     _mm_packus_epi16(x, x));
+  }
+  for (; k < n; k++) {
+    int32_t acc = 0;
+    for (int32_t j = 0; j < taps; j++)
+      acc += rows[j][k] * weights[j];
+    out[k] = fixedToUint8(acc);
+  }
+}
+
+// Row sums of the box reduction.
+template <typename T> void
+boxY (float *acc, const void *src, int32_t n)
+{
+  const T *in = static_cast<const T *>(src);
+  int32_t  k  = 0;
+
+  for (; k + 4 <= n; k += 4)
+    _mm_storeu_ps(acc + k, _mm_add_ps(_mm_loadu_ps(acc + k), load4<T>(in + k)));
+  for (; k < n; k++)
+    acc[k] += in[k];
+}
+
+// Box sums of pixels of 3 or 4 samples, a pixel per vector. The fourth
+// lane of a 3 sample pixel is the next pixel's and is dropped; the last
+// one of a row is loaded without it.
+template <typename T, int nComps, int KX> void
+boxX (void *dst, const float *acc, int32_t width, int32_t kx, float scale)
+{
+  if (KX)
+    kx = KX;
+  T     *out = static_cast<T *>(dst);
+  __m128 s   = _mm_set1_ps(scale);
+  float  v[4];
+
+  for (int32_t i = 0; i < width; i++) {
+    const float *p   = acc + i * kx * nComps;
+    __m128       sum = _mm_setzero_ps();
+    for (int32_t j = 0; j < kx; j++) {
+      bool last = nComps == 3 && i == width - 1 && j == kx - 1;
+      sum = _mm_add_ps(sum, last ? load3(p + j * nComps)
+                                 : _mm_loadu_ps(p + j * nComps));
+    }
+    _mm_storeu_ps(v, _mm_mul_ps(sum, s));
+    for (int c = 0; c < nComps; c++)
+      out[i * nComps + c] = store1<T>(v[c]);
+  }
+}
+
+template <typename T, int TAPS> void
+setupConvolveX (ConvolveRowX *row)
+{
+  row[0] = convolveX1<T, TAPS>;
+  row[1] = convolveX2<T, TAPS>;
+  row[2] = convolveX3<T, TAPS>;
+  row[3] = convolveX4<T, TAPS>;
+}
+
+// Kernels for windows of TAPS taps, any number if 0.
+template <int TAPS> void
+setupTaps (struct ResampleKernels *kernels)
+{
+  const int c = TAPS / TAP_CLASS_STEP;
+
+  setupConvolveX<uint8_t,  TAPS>(kernels->convolveX[c][sample_uint8]);
+  setupConvolveX<uint16_t, TAPS>(kernels->convolveX[c][sample_uint16]);
+  setupConvolveX<float,    TAPS>(kernels->convolveX[c][sample_float]);
+  kernels->convolveY[c][sample_uint8]  = convolveY<uint8_t,  TAPS>;
+  kernels->convolveY[c][sample_uint16] = convolveY<uint16_t, TAPS>;
+  kernels->convolveY[c][sample_float]  = convolveY<float,    TAPS>;
+  kernels->convolveYSource[c][sample_uint8]  = convolveYSource<uint8_t,  TAPS>;
+  kernels->convolveYSource[c][sample_uint16] = convolveYSource<uint16_t, TAPS>;
+  kernels->convolveYSource[c][sample_float]  = convolveYSource<float,    TAPS>;
+  kernels->convolveXFixed[c][0] = convolveXFixed1<TAPS>;
+  kernels->convolveXFixed[c][1] = convolveXFixed2<TAPS>;
+  kernels->convolveXFixed[c][2] = convolveXFixed3<TAPS>;
+  kernels->convolveXFixed[c][3] = convolveXFixed4<TAPS>;
+  kernels->convolveYFixed[c]    = convolveYFixed<TAPS>;
+}
+
+template <typename T, int KX> void
+setupBoxX (BoxRowX *row)
+{
+  row[2] = boxX<T, 3, KX>;
+  row[3] = boxX<T, 4, KX>;
+}
+
+// Box kernels for a factor of KX, any factor if 0.
+template <int KX> void
+setupBox (struct ResampleKernels *kernels)
+{
+  const int c = boxClass(KX);
+
+  setupBoxX<uint8_t,  KX>(kernels->boxX[c][sample_uint8]);
+  setupBoxX<uint16_t, KX>(kernels->boxX[c][sample_uint16]);
+  setupBoxX<float,    KX>(kernels->boxX[c][sample_float]);
+}
+
+} // namespace
+
+void
+setupResampleKernelsSSE2 (struct ResampleKernels *kernels)
+{
+  kernels->name = "sse2";
+  setupTaps<0> (kernels);
+  setupTaps<4> (kernels);
+  setupTaps<8> (kernels);
+  setupTaps<12>(kernels);
+  setupTaps<16>(kernels);
+  kernels->boxY[sample_uint8]  = boxY<uint8_t>;
+  kernels->boxY[sample_uint16] = boxY<uint16_t>;
+  kernels->boxY[sample_float]  = boxY<float>;
+  setupBox<0>(kernels);
+  setupBox<2>(kernels);
+  setupBox<4>(kernels);
+  setupBox<8>(kernels);
+}
+
+#endif // x86
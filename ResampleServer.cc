@@ -0,0 +1,346 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <algorithm>
+
+#include "ImageAllocator.hh"
+#include "ResamplePlan.hh"
+#include "ResampleServer.hh"
+#include "ResampleStats.hh"
+
+// Jobs whose latency is kept for the percentiles.
+#define SERVER_SAMPLES 4096
+
+// Longest request line, in bytes; longer ones are answered with an error.
+#define SERVER_MAX_LINE 65536
+
+// One client: requests are read on one thread, replies written by the
+// workers.
+struct ResampleServer::Connection
+{
+  int        in, out;
+  bool       owned;       // close in, which is also out, when done
+  uint64_t   requests;
+  std::mutex lock;
+
+  Connection(int in, int out, bool owned) :
+    in(in), out(out), owned(owned), requests(0) {};
+  ~Connection()
+    {
+      if (owned)
+        close(in);
+    };
+
+  // Write a line, whole. A client that went away is ignored.
+  void reply(const std::string& line)
+    {
+      std::string data = line + "\n";
+      std::lock_guard<std::mutex> guard(lock);
+      size_t n = 0;
+      while (n < data.size()) {
+        ssize_t w = write(out, data.data() + n, data.size() - n);
+        if (w < 0 && errno == EINTR)
+          continue;
+        if (w <= 0)
+          return;
+        n += w;
+      }
+    };
+};
+
+ResampleServer::ResampleServer (const ServerJob& job, int32_t workers,
+                                size_t depth) :
+  job(job), queue(depth), running(0), stopping(false), listener(-1),
+  buffers(NULL), done(0), failed(0), readers(0)
+{
+  if (workers < 1)
+    workers = 1;
+  for (int32_t i = 0; i < workers; i++)
+    this->workers.push_back(std::thread(&ResampleServer::work, this));
+}
+
+ResampleServer::~ResampleServer ()
+{
+  finish();
+}
+
+// Let the workers empty the queue and end.
+void
+ResampleServer::finish ()
+{
+  queue.close();
+  for (size_t i = 0; i < workers.size(); i++) {
+    if (workers[i].joinable())
+      workers[i].join();
+  }
+}
+
+void
+ResampleServer::work ()
+{
+  Request request;
+  while (queue.pop(request)) {
+    int64_t start = ResampleStats::wallClock();
+    running++;
+    std::string error;
+    int status = job(request.line, error);
+    running--;
+    int64_t end = ResampleStats::wallClock();
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      size_t k = done % SERVER_SAMPLES;
+      if (latencies.size() < SERVER_SAMPLES) {
+        latencies.push_back(0);
+        waits.push_back(0);
+      }
+      latencies[k] = end - request.received;
+      waits[k]     = start - request.received;
+      done++;
+      if (status != 0)
+        failed++;
+    }
+
+    char head[64];
+    if (status == 0)
+      snprintf(head, sizeof(head), "%llu ok %.3f",
+               (unsigned long long) request.number,
+               (end - request.received) / 1e6);
+    else
+      snprintf(head, sizeof(head), "%llu error ",
+               (unsigned long long) request.number);
+    request.connection->reply(std::string(head) + (status == 0 ? "" : error));
+    request.connection.reset();
+  }
+}
+
+// Percentile p of sorted samples, nearest rank, in milliseconds.
+static double
+percentile (const std::vector<int64_t>& sorted, double p)
+{
+  if (sorted.empty())
+    return 0;
+  size_t rank = (size_t) (p / 100.0 * sorted.size() + 0.5);
+  rank = std::min(std::max(rank, (size_t) 1), sorted.size());
+  return sorted[rank - 1] / 1e6;
+}
+
+std::string
+ResampleServer::getStatus ()
+{
+  std::vector<int64_t> latency, wait;
+  uint64_t             jobs, errors;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    latency = latencies;
+    wait    = waits;
+    jobs    = done;
+    errors  = failed;
+  }
+  std::sort(latency.begin(), latency.end());
+  std::sort(wait.begin(), wait.end());
+
+  ResamplePlanCache& cache = ResamplePlanCache::shared();
+  char status[512];
+  snprintf(status, sizeof(status),
+           "{\"done\": %llu, \"failed\": %llu, \"queued\": %llu, "
+           "\"running\": %d, \"workers\": %d, "
+           "\"latency_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, "
+           "\"max\": %.3f}, "
+           "\"wait_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, "
+           "\"max\": %.3f}, "
+           "\"plan_hits\": %llu, \"plan_misses\": %llu}",
+           (unsigned long long) jobs, (unsigned long long) errors,
+           (unsigned long long) queue.size(), (int) running,
+           (int) workers.size(),
+           percentile(latency, 50), percentile(latency, 90),
+           percentile(latency, 99), percentile(latency, 100),
+           percentile(wait, 50), percentile(wait, 90),
+           percentile(wait, 99), percentile(wait, 100),
+           (unsigned long long) cache.getHits(),
+           (unsigned long long) cache.getMisses());
+  if (!buffers)
+    return status;
+  return std::string(status, strlen(status) - 1) + ", \"buffer_pool\": " +
+         buffers->getStatus() + "}";
+}
+
+bool
+ResampleServer::readRequests (const std::shared_ptr<Connection>& connection)
+{
+  std::string pending;
+  char        buffer[4096];
+  bool        overlong = false;  // dropping the rest of a long line
+
+  for (;;) {
+    std::string::size_type eol;
+    while ((eol = pending.find('\n')) != std::string::npos) {
+      std::string line = pending.substr(0, eol);
+      pending.erase(0, eol + 1);
+      if (overlong) {
+        overlong = false;
+        continue;
+      }
+      if (line.size() > SERVER_MAX_LINE) {
+        connection->reply(std::to_string(++connection->requests) +
+                          " error request too long");
+        continue;
+      }
+      if (!line.empty() && line[line.size() - 1] == '\r')
+        line.erase(line.size() - 1);
+      if (line.find_first_not_of(" \t") == std::string::npos)
+        continue;
+
+      if (line == "stats") {
+        connection->reply(getStatus());
+        continue;
+      }
+      if (line == "quit")
+        return false;
+
+      Request request;
+      request.connection = connection;
+      request.number     = ++connection->requests;
+      request.line       = line;
+      request.received   = ResampleStats::wallClock();
+      if (!queue.push(std::move(request)))
+        connection->reply(std::to_string(connection->requests) +
+                          " error server stopping");
+    }
+
+    ssize_t n = read(connection->in, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return true;
+    pending.append(buffer, n);
+    // No end of line yet within the limit: answer now and drop the line
+    // up to its end as it comes.
+    if (pending.size() > SERVER_MAX_LINE &&
+        pending.find('\n') == std::string::npos) {
+      if (!overlong)
+        connection->reply(std::to_string(++connection->requests) +
+                          " error request too long");
+      overlong = true;
+      pending.clear();
+    }
+  }
+}
+
+int
+ResampleServer::serveStream (int in, int out)
+{
+  std::shared_ptr<Connection> connection(new Connection(in, out, false));
+  readRequests(connection);
+  finish();
+  return 0;
+}
+
+// Wake everything blocked reading requests.
+void
+ResampleServer::stop ()
+{
+  stopping = true;
+  shutdown(listener, SHUT_RDWR);
+  std::lock_guard<std::mutex> guard(lock);
+  for (size_t i = 0; i < connections.size(); i++) {
+    std::shared_ptr<Connection> connection = connections[i].lock();
+    if (connection)
+      shutdown(connection->in, SHUT_RD);
+  }
+}
+
+int
+ResampleServer::serveSocket (const std::string& path)
+{
+  struct sockaddr_un address;
+  if (path.size() >= sizeof(address.sun_path))
+    return -1;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path.c_str());
+
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0)
+    return -1;
+  // Replace a socket left by a server that is gone, but nothing else:
+  // not a file, nor the socket of a server still listening.
+  struct stat info;
+  if (lstat(path.c_str(), &info) == 0) {
+    bool stale = false;
+    if (S_ISSOCK(info.st_mode)) {
+      int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+      stale = probe >= 0 &&
+              connect(probe, (struct sockaddr *) &address,
+                      sizeof(address)) != 0 && errno == ECONNREFUSED;
+      if (probe >= 0)
+        close(probe);
+    }
+    if (!stale) {
+      close(listener);
+      listener = -1;
+      return -1;
+    }
+    unlink(path.c_str());
+  }
+  if (bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+      listen(listener, SOMAXCONN) != 0 ||
+      lstat(path.c_str(), &info) != 0) {
+    close(listener);
+    listener = -1;
+    return -1;
+  }
+
+  while (!stopping) {
+    int client = accept(listener, NULL, NULL);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      break;
+    }
+    std::shared_ptr<Connection> connection(
+        new Connection(client, client, true));
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      // Forget the clients that are gone.
+      connections.erase(
+          std::remove_if(connections.begin(), connections.end(),
+                         [](const std::weak_ptr<Connection>& c) {
+                           return c.expired();
+                         }),
+          connections.end());
+      connections.push_back(connection);
+      readers++;
+    }
+    // The connection lives as long as its reader or jobs hold it.
+    std::thread([this, connection]() {
+      if (!readRequests(connection))
+        stop();
+      std::lock_guard<std::mutex> guard(lock);
+      if (--readers == 0)
+        idle.notify_all();
+    }).detach();
+    if (stopping)
+      stop();
+  }
+  // Also when accept() failed, for the clients still being read.
+  stop();
+
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this] { return readers == 0; });
+  }
+  finish();
+  close(listener);
+  listener = -1;
+  // Unless another server has replaced it since.
+  struct stat now;
+  if (lstat(path.c_str(), &now) == 0 && now.st_dev == info.st_dev &&
+      now.st_ino == info.st_ino)
+    unlink(path.c_str());
+  return 0;
+}
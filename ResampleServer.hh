@@ -0,0 +1,99 @@
+#ifndef __RESAMPLESERVER_HH__
+#define __RESAMPLESERVER_HH__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BoundedQueue.hh"
+
+class BufferPool;
+
+// Runs the job of one request line. Returns 0, or -1 with a message in
+// error.
+typedef std::function<int(const std::string& request, std::string& error)>
+    ServerJob;
+
+// A long running process that takes requests one per line, from stdin or
+// from the clients of a Unix domain socket, and runs them as jobs on a
+// fixed set of worker threads. Plans in the shared ResamplePlanCache and
+// freed buffers stay with the process from one job to the next.
+//
+// A line "stats" is answered at once with the state of the server as a
+// line of JSON: jobs done and failed, jobs queued and running, and
+// percentiles of the latency (from reading the request to sending the
+// reply) and of the wait in the queue over the last SERVER_SAMPLES jobs,
+// plan cache hits and misses, and the counts of the buffer pool.
+// A line "quit" stops reading requests; the jobs already queued are
+// finished. Any other line is a job, answered when it is done with
+// "n ok ms" or "n error message", n counting the jobs of the connection
+// from 1: replies come in the order jobs finish. A line longer than
+// SERVER_MAX_LINE is answered with an error and not run. When depth jobs
+// are queued, reading requests waits for room.
+class ResampleServer
+{
+public:
+  ResampleServer(const ServerJob& job, int32_t workers, size_t depth);
+  ~ResampleServer();
+
+  // Serve the requests of in, replying to out, until its end or quit.
+  // Returns 0, or -1 on a read error.
+  int serveStream(int in, int out);
+  // Serve the clients of a socket made at path until one of them sends
+  // quit. A socket at path that no server listens on any more is
+  // replaced. Returns 0, or -1 if the socket can not be made or anything
+  // else is at path.
+  int serveSocket(const std::string& path);
+
+  // Have the status include the counts of the pool the jobs allocate
+  // from, or not if NULL (the default).
+  void setBufferPool(const BufferPool *buffers) { this->buffers = buffers; };
+
+  std::string getStatus();
+
+private:
+  ResampleServer(const ResampleServer&);
+  ResampleServer& operator=(const ResampleServer&);
+
+  struct Connection;
+  struct Request
+  {
+    std::shared_ptr<Connection> connection;
+    uint64_t                    number;
+    std::string                 line;
+    int64_t                     received;
+  };
+
+  ServerJob                 job;
+  BoundedQueue<Request>     queue;
+  std::vector<std::thread>  workers;
+  std::atomic<int32_t>      running;
+  std::atomic<bool>         stopping;
+  int                       listener;
+  const BufferPool         *buffers;
+
+  // Latency and wait of the last SERVER_SAMPLES jobs, in nanoseconds.
+  std::mutex                lock;
+  std::vector<int64_t>      latencies, waits;
+  uint64_t                  done, failed;
+  // Clients of the socket, and the threads reading their requests.
+  std::vector<std::weak_ptr<Connection> > connections;
+  int32_t                   readers;
+  std::condition_variable   idle;
+
+  void work();
+  // Read requests of connection until its end or quit; false on quit.
+  bool readRequests(const std::shared_ptr<Connection>& connection);
+  void stop();
+  void finish();
+};
+
+#endif // __RESAMPLESERVER_HH__
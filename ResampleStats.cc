@@ -0,0 +1,125 @@
+#include <time.h>
+#include <sys/resource.h>
+
+#include "ResamplePlan.hh"
+#include "ResampleStats.hh"
+
+ResampleStats::ResampleStats ()
+{
+  for (int i = 0; i < NUM_STAGES; i++) {
+    wallNs[i] = 0;
+    cpuNs[i]  = 0;
+  }
+  bytesRead = bytesWritten = 0;
+}
+
+void
+ResampleStats::addTime (int stage, int64_t wall, int64_t cpu)
+{
+  wallNs[stage] += wall;
+  cpuNs[stage]  += cpu;
+}
+
+void
+ResampleStats::addPlan (const ResamplePlan& plan,
+                        enum resample_passes_e passes)
+{
+  PlanInfo info;
+  info.filter    = plan.getFilterName();
+  info.srcWidth  = plan.getSrcWidth();
+  info.srcHeight = plan.getSrcHeight();
+  info.dstWidth  = plan.getDstWidth();
+  info.dstHeight = plan.getDstHeight();
+  info.boxX      = plan.getBoxX();
+  info.boxY      = plan.getBoxY();
+  info.tapsX     = plan.getContributorX().getTaps();
+  info.tapsY     = plan.getContributorY().getTaps();
+  info.passes    = passes;
+  info.costXY    = plan.getCost(false);
+  info.costYX    = plan.getCost(true);
+
+  std::lock_guard<std::mutex> guard(lock);
+  for (size_t i = 0; i < plans.size(); i++) {
+    const PlanInfo& p = plans[i];
+    if (p.filter == info.filter &&
+        p.srcWidth == info.srcWidth && p.srcHeight == info.srcHeight &&
+        p.dstWidth == info.dstWidth && p.dstHeight == info.dstHeight &&
+        p.boxX == info.boxX && p.boxY == info.boxY &&
+        p.passes == info.passes)
+      return;
+  }
+  plans.push_back(info);
+}
+
+void
+ResampleStats::writeJSON (FILE *fp, const char *indent) const
+{
+  fprintf(fp, "%s\"stages\": {\n", indent);
+  for (int i = 0; i < NUM_STAGES; i++)
+    fprintf(fp, "%s  \"%s\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f}%s\n",
+            indent, getStageName(i), wallNs[i] / 1e6, cpuNs[i] / 1e6,
+            i + 1 < NUM_STAGES ? "," : "");
+  fprintf(fp, "%s},\n", indent);
+
+  fprintf(fp, "%s\"plans\": [\n", indent);
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t i = 0; i < plans.size(); i++) {
+      const PlanInfo& p = plans[i];
+      // Costs in millions of taps.
+      fprintf(fp, "%s  {\"filter\": \"%s\", \"src\": [%d, %d], "
+              "\"dst\": [%d, %d], \"box\": [%d, %d], \"taps\": [%d, %d], "
+              "\"passes\": \"%s\", \"cost_xy\": %.3f, \"cost_yx\": %.3f}%s\n",
+              indent, p.filter.c_str(), (int) p.srcWidth, (int) p.srcHeight,
+              (int) p.dstWidth, (int) p.dstHeight, (int) p.boxX, (int) p.boxY,
+              (int) p.tapsX, (int) p.tapsY,
+              ResamplePlan::getPassesName(p.passes), p.costXY / 1e6,
+              p.costYX / 1e6, i + 1 < plans.size() ? "," : "");
+    }
+  }
+  fprintf(fp, "%s],\n", indent);
+
+  fprintf(fp, "%s\"bytes_read\": %llu,\n%s\"bytes_written\": %llu,\n"
+          "%s\"peak_rss\": %llu\n",
+          indent, (unsigned long long) bytesRead,
+          indent, (unsigned long long) bytesWritten,
+          indent, (unsigned long long) peakRSS());
+}
+
+const char *
+ResampleStats::getStageName (int stage)
+{
+  static const char *const names[NUM_STAGES] = {
+    "decode", "setup", "shrink", "x", "y", "encode"
+  };
+  return stage >= 0 && stage < NUM_STAGES ? names[stage] : "";
+}
+
+int64_t
+ResampleStats::wallClock ()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (int64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+int64_t
+ResampleStats::cpuClock ()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+  return (int64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+uint64_t
+ResampleStats::peakRSS ()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  return (uint64_t) usage.ru_maxrss;        // bytes
+#else
+  return (uint64_t) usage.ru_maxrss * 1024; // kilobytes
+#endif
+}
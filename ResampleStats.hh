@@ -0,0 +1,157 @@
+#ifndef __RESAMPLESTATS_HH__
+#define __RESAMPLESTATS_HH__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ResamplePlan.hh"
+#include "RowStream.hh"
+
+enum resample_stage_e
+{
+  stage_decode = 0,
+  stage_setup,      // contributor tables, or finding them in the cache
+  stage_shrink,     // box pre-reduction
+  stage_x,          // horizontal pass
+  stage_y,          // vertical pass
+  stage_encode,
+  NUM_STAGES
+};
+
+// Wall and CPU time spent in each stage of a job, the plans it used and
+// the bytes it read and wrote. CPU time is that of the whole process, so
+// that it includes the threads of a pool; stages running at the same time
+// on several threads are each charged for all of it. All methods are
+// thread-safe. Timing a stage costs two clock reads at each end, under a
+// microsecond; the streaming paths time every row.
+class ResampleStats
+{
+public:
+  ResampleStats();
+
+  void addTime(int stage, int64_t wallNs, int64_t cpuNs);
+  // Record a plan and the passes it ran with once, however many times
+  // they are used.
+  void addPlan(const ResamplePlan& plan, enum resample_passes_e passes);
+  void addBytesRead(uint64_t bytes)    { bytesRead += bytes; };
+  void addBytesWritten(uint64_t bytes) { bytesWritten += bytes; };
+
+  int64_t  getWallNs(int stage) const { return wallNs[stage]; };
+  int64_t  getCPUNs(int stage) const  { return cpuNs[stage]; };
+  uint64_t getBytesRead() const    { return bytesRead; };
+  uint64_t getBytesWritten() const { return bytesWritten; };
+
+  // Write everything as the members of a JSON object, without the braces,
+  // each line starting with indent.
+  void writeJSON(FILE *fp, const char *indent) const;
+
+  static const char *getStageName(int stage);
+  // Monotonic wall clock and process CPU time, in nanoseconds.
+  static int64_t wallClock();
+  static int64_t cpuClock();
+  // Peak resident set size of the process so far, in bytes.
+  static uint64_t peakRSS();
+
+private:
+  ResampleStats(const ResampleStats&);
+  ResampleStats& operator=(const ResampleStats&);
+
+  struct PlanInfo
+  {
+    std::string filter;
+    int32_t srcWidth, srcHeight, dstWidth, dstHeight;
+    int32_t boxX, boxY;
+    int32_t tapsX, tapsY;
+    enum resample_passes_e passes;
+    double  costXY, costYX;
+  };
+
+  std::atomic<int64_t>  wallNs[NUM_STAGES];
+  std::atomic<int64_t>  cpuNs[NUM_STAGES];
+  std::atomic<uint64_t> bytesRead, bytesWritten;
+
+  mutable std::mutex    lock;
+  std::vector<PlanInfo> plans;
+};
+
+// Charges the time from construction to destruction to a stage; does
+// nothing without stats.
+class StageTimer
+{
+public:
+  StageTimer(ResampleStats *stats, int stage) :
+    stats(stats), stage(stage), wall(0), cpu(0)
+    {
+      if (stats) {
+        wall = ResampleStats::wallClock();
+        cpu  = ResampleStats::cpuClock();
+      }
+    };
+  ~StageTimer()
+    {
+      if (stats)
+        stats->addTime(stage, ResampleStats::wallClock() - wall,
+                       ResampleStats::cpuClock() - cpu);
+    };
+
+private:
+  StageTimer(const StageTimer&);
+  StageTimer& operator=(const StageTimer&);
+
+  ResampleStats *stats;
+  int            stage;
+  int64_t        wall, cpu;
+};
+
+// Rows of another source, their reading charged to stage_decode.
+class TimedRowSource : public RowSource
+{
+public:
+  TimedRowSource(RowSource& source, ResampleStats *stats) :
+    source(source), stats(stats) {};
+
+  virtual int32_t getWidth()  const { return source.getWidth(); };
+  virtual int32_t getHeight() const { return source.getHeight(); };
+  virtual int8_t  getNComps() const { return source.getNComps(); };
+  virtual int8_t  getBPC()    const { return source.getBPC(); };
+
+  virtual bool readRow(void *row)
+  {
+    StageTimer timer(stats, stage_decode);
+    return source.readRow(row);
+  };
+
+private:
+  RowSource&     source;
+  ResampleStats *stats;
+};
+
+// Rows to another sink, their writing charged to stage_encode.
+class TimedRowSink : public RowSink
+{
+public:
+  TimedRowSink(RowSink& sink, ResampleStats *stats) :
+    sink(sink), stats(stats) {};
+
+  virtual bool writeRow(const void *row)
+  {
+    StageTimer timer(stats, stage_encode);
+    return sink.writeRow(row);
+  };
+  virtual int close()
+  {
+    StageTimer timer(stats, stage_encode);
+    return sink.close();
+  };
+
+private:
+  RowSink&       sink;
+  ResampleStats *stats;
+};
+
+#endif // __RESAMPLESTATS_HH__
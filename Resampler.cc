@@ -2,74 +2,45 @@
 // THIS FILE IS IN THE PUBLIC DOMAIN
 
 #include <math.h>
+#include <string.h>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
+#include "AlignedAlloc.hh"
+#include "LinearLight.hh"
+#include "ResampleKernels.hh"
+#include "ResampleStats.hh"
 #include "Resampler.hh"
+#include "RowStream.hh"
+#include "ScratchFile.hh"
+#include "ThreadPool.hh"
+
+// Cost of the passes in fixed point relative to float, for the choice of
+// their order.
+#define FIXED_POINT_COST 0.8
 
 //
-// Interpolaion kernels: Box (Nearest Neighbor), Bilinear, B-spline,
-//                       Bicubic, Lanczos3, Mitchell
+// Interpolaion kernels: Box (Nearest Neighbor), Bilinear, cubics of the
+//                       Mitchell-Netravali family, Lanczos, Gaussian
 //
-#define BOX_SUPPORT 0.5
-float Resampler::box_filter (float t)
+float Resampler::box_filter (float t, float, float)
 {
   return (((t > -0.5) && (t <= 0.5)) ? 1.0 : 0.0);
 }
 
-#define BILINEAR_SUPPORT 1.0
-float Resampler::bilinear_filter (float t)
+float Resampler::bilinear_filter (float t, float, float)
 {
   if (t < 0.0)
     t = -t;
   return (t < 1.0 ? 1.0 - t : 0);
 }
 
-#define B_SPLINE_SUPPORT 2.0
-float Resampler::B_spline_filter (float t)
-{
-  if (t < 0.0)
-    t = -t;
-  if (t < 1.0) {
-    return ((0.5 * t * t * t) - t * t + (2.0 / 3.0));
-  } else if (t < 2) {
-    t = 2 - t;
-    return ((1.0 / 6.0) * (t * t * t));
-  }
-  return 0.0;
-}
-
-#define BICUBIC_SUPPORT 2.0
-#define a -0.5
-float Resampler::bicubic_filter (float t)
-{
-  if (t < 0.0)
-    t = -t;
-  if (t < 1.0)
-    return ((a+2.0)*t*t*t - (a+3.0)*t*t + 1.0);
-  else if (t < 2.0)
-   return (a*t*t*t - 5.0*a*t*t + 8.0*a*t - 4.0*a);
-  return 0.0;
-}
-#undef a
-
-#ifndef sinc
-#  define sinc(x) (((x) != 0.0) ? (sin((x) * M_PI) / ((x) * M_PI)) : 1.0)
-#endif
-#define LANCZOS3_SUPPORT 3.0
-float Resampler::Lanczos3_filter (float t)
-{
-  if (t < 0)
-   t = -t;
-  return ((t < 3.0) ? (sinc(t) * sinc( t / 3.0)) : 0.0);
-}
-
-// Mitchell filter
-#define  MITCHELL_SUPPORT 2.0
-#define  B  (1.0 / 3.0)
-#define  C  (1.0 / 3.0)
-float Resampler::Mitchell_filter (float t)
+// Mitchell-Netravali cubic of parameters B and C, support 2: B = 1, C = 0
+// is the cubic B-spline, B = 0, C = 0.5 the Keys cubic of a = -0.5
+// (Catmull-Rom), B = C = 1/3 the Mitchell filter.
+float Resampler::cubic_filter (float t, float B, float C)
 {
   float tt = t*t;
   if (t < 0)
@@ -88,174 +59,940 @@ float Resampler::Mitchell_filter (float t)
   }
   return 0.0;
 }
-#undef B
-#undef C
 
+#ifndef sinc
+#  define sinc(x) (((x) != 0.0) ? (sin((x) * M_PI) / ((x) * M_PI)) : 1.0)
+#endif
+// Lanczos window of lobes lobes, the support.
+float Resampler::Lanczos_filter (float t, float lobes, float)
+{
+  if (t < 0)
+   t = -t;
+  return ((t < lobes) ? (sinc(t) * sinc(t / lobes)) : 0.0);
+}
+
+// Not normalized: the contributors are. At a support of 4 sigma it is
+// down to 3e-4.
+float Resampler::Gaussian_filter (float t, float sigma, float)
+{
+  return exp(-t * t / (2.0 * sigma * sigma));
+}
+
+// Parametric variants are entries of a family here, with their support.
 const struct filterItem Resampler::filters[] = {
-  {"Box",       Resampler::box_filter,      BOX_SUPPORT},
-  {"Bilinear",  Resampler::bilinear_filter, BILINEAR_SUPPORT},
-  {"B-spline",  Resampler::B_spline_filter, B_SPLINE_SUPPORT},
-  {"Bicubic",   Resampler::bicubic_filter,  BICUBIC_SUPPORT},
-  {"Lanczos",   Resampler::Lanczos3_filter, LANCZOS3_SUPPORT},
-  {"Mitchell",  Resampler::Mitchell_filter, MITCHELL_SUPPORT}
+  {"Box",       Resampler::box_filter,      0.5, 0.0,       0.0},
+  {"Bilinear",  Resampler::bilinear_filter, 1.0, 0.0,       0.0},
+  {"B-spline",  Resampler::cubic_filter,    2.0, 1.0,       0.0},
+  {"Bicubic",   Resampler::cubic_filter,    2.0, 0.0,       0.5},
+  {"Lanczos",   Resampler::Lanczos_filter,  3.0, 3.0,       0.0},
+  {"Mitchell",  Resampler::cubic_filter,    2.0, 1.0 / 3.0, 1.0 / 3.0},
+  {"Lanczos2",  Resampler::Lanczos_filter,  2.0, 2.0,       0.0},
+  {"Lanczos4",  Resampler::Lanczos_filter,  4.0, 4.0,       0.0},
+  {"Gaussian",  Resampler::Gaussian_filter, 2.0, 0.5,       0.0}
 };
 const int Resampler::NUM_FILTERS = (sizeof(filters) / sizeof(filters[0]));
 
 // Resampler class
-Resampler::Resampler ()
+Resampler::Resampler () : Resampler("Bicubic") // default to Bicubic
 {
-  Resampler("Bicubic"); // default to Bicubic
+
 }
 
 Resampler::Resampler (const std::string& filter)
 {
-  filter_fn = filters[0].func;
-  support   = filters[0].support;
+  this->filter = findFilter(filter);
+  this->cache  = &ResamplePlanCache::shared();
+  this->pool   = NULL;
+  this->stats  = NULL;
+  this->fixedPoint = true;
+  this->shrinkOnLoad = false;
+}
+
+Resampler::Resampler (const std::string& filter, ResamplePlanCache& cache)
+{
+  this->filter = findFilter(filter);
+  this->cache  = &cache;
+  this->pool   = NULL;
+  this->stats  = NULL;
+  this->fixedPoint = true;
+  this->shrinkOnLoad = false;
+}
+
+Resampler::~Resampler ()
+{
+
+}
+
+// Unknown names fall back to the first filter (Box).
+const struct filterItem *
+Resampler::findFilter (const std::string& name)
+{
   for (int i = 0; i < NUM_FILTERS; i++) {
-    if (filter == filters[i].name) {
-      filter_fn = filters[i].func;
-      support   = filters[i].support;
-      break;
-    }
+    if (name == filters[i].name)
+      return &filters[i];
   }
+  return &filters[0];
 }
 
-Resampler::~Resampler ()
+std::shared_ptr<const ResamplePlan>
+Resampler::getPlan (int32_t srcWidth, int32_t srcHeight,
+                    int32_t dstWidth, int32_t dstHeight) const
 {
+  StageTimer timer(stats, stage_setup);
+  return cache->get(*filter, srcWidth, srcHeight, dstWidth, dstHeight,
+                    shrinkOnLoad && !linear);
+}
 
+void
+Resampler::recordPlan (const ResamplePlan& plan,
+                       enum resample_passes_e passes) const
+{
+  if (stats)
+    stats->addPlan(plan, passes);
 }
 
-// Calculate how much sorrounding pixels contribute
 void
-Resampler::setupContributorForDownsample (float   scale,
-                                          int32_t dstSize,
-                                          int32_t boundary)
-{
-  float supportSize = support / scale;
-
-  contributor.resize(dstSize);
-
-  for (int32_t i = 0; i < dstSize; i++) {
-    contributor[i].n = 0;
-    std::vector<Contrib> p((int) (supportSize * 2 + 1));
-    contributor[i].p = p;
-    float center = (float) i / scale;
-    float left   = ceil (center - supportSize);
-    float right  = floor(center + supportSize);
-    float total  = 0.0; // Normalization required
-    for (int32_t k = left; k <= right; k++) {
-      total += (*filter_fn)((center - k) * scale);
-    }
-    for (int32_t j = left; j <= right; j++) {
-      int32_t n = j;
-      float weight = (*filter_fn)((center - j) * scale) / total;
-      // reflect at boundary
-      if (j < 0) {
-        n = - j; // or periodic: dstSize - j
-      } else if (j >= boundary) {
-        n = (boundary - j) + boundary - 1; // j - boundary
+Resampler::forBands (int32_t count,
+                     const std::function<void(int32_t, int32_t)>& body) const
+{
+  if (pool)
+    pool->parallelFor(count, body);
+  else
+    body(0, count);
+}
+
+// Horizontal pass into a float image, bands of source rows. In linear
+// light each row is decoded to floats first, unless it is already. The
+// last pass goes through a row of float sums into the output.
+void
+Resampler::resampleX (Image& dst, const Image& src,
+                      const ContribTable& contributor, bool decoded,
+                      bool last) const
+{
+  bool  decode = linear && !decoded;
+  int   bpc    = decode ? 32 : src.getBPC();
+  ConvolveRowX kernel = selectConvolveX(getResampleKernels(), bpc,
+                                        src.getNComps(), contributor.getTaps());
+  float scale = 1.0 / sampleMaxValue(bpc);
+
+  forBands(dst.getHeight(), [&](int32_t begin, int32_t end) {
+    std::vector<float> row(decode ? src.getWidth() * src.getNComps() : 0);
+    std::vector<float> sums(last ? dst.getWidth() * dst.getNComps() : 0);
+    for (int32_t k = begin; k < end; k++) {
+      const void *in = src.getRow(k);
+      if (decode) {
+        linear->decodeRow(row.data(), in, src.getWidth(), src.getNComps(),
+                          src.getBPC());
+        in = row.data();
       }
-      int k = contributor[i].n++;
-      contributor[i].p[k].pixel  = n;      // positio of kth contributor
-      contributor[i].p[k].weight = weight; // weight
+      (*kernel)(last ? sums.data() : dst.getRowAs<float>(k), in,
+                dst.getWidth(), contributor.getStart(),
+                contributor.getWeights(), contributor.getTaps(), scale);
+      if (last)
+        storeRow(dst, k, sums.data());
     }
-  }
+  });
 }
 
+// Vertical pass from a float image, bands of output rows. Each output row
+// is a weighted sum of whole source rows, so memory is read sequentially.
+// In linear light the sums are floats, encoded a row at a time.
 void
-Resampler::setupContributorForUpsample (float   scale,
-                                        int32_t dstSize,
-                                        int32_t boundary)
-{
-  contributor.resize(dstSize);
-
-  for (int32_t i = 0; i < dstSize; i++) {
-    contributor[i].n = 0;
-    std::vector<Contrib> p((int)(support * 2 + 1));
-    contributor[i].p = p;
-    float center = (float) i / scale;
-    float left   = ceil (center - support);
-    float right  = floor(center + support);
-    for (int32_t j = left; j <= right; j++) {
-      float   weight = (*filter_fn)(center - j);
-      int32_t n = j;
-      // reflect at boundary
-      if (j < 0) {
-        n = -j;
-      } else if (j >= boundary) {
-        n = (boundary - j) + boundary - 1;
-      }
-      int k = contributor[i].n++;
-      contributor[i].p[k].pixel  = n;
-      contributor[i].p[k].weight = weight;
+Resampler::resampleY (Image& dst, const Image& src,
+                      const ContribTable& contributor, int32_t first) const
+{
+  int     bpc   = linear ? 32 : dst.getBPC();
+  ConvolveRowY kernel = selectConvolveY(getResampleKernels(), bpc,
+                                        contributor.getTaps());
+  int32_t taps  = contributor.getTaps();
+  int32_t n     = dst.getWidth() * dst.getNComps();
+  float   scale = sampleMaxValue(bpc);
+
+  forBands(dst.getHeight(), [&](int32_t begin, int32_t end) {
+    std::vector<const float *> rows(taps);
+    std::vector<float> sums(linear ? n : 0);
+    for (int32_t i = begin; i < end; i++) {
+      for (int32_t j = 0; j < taps; j++)
+        rows[j] = src.getRowAs<float>(contributor.getStart(first + i) + j);
+      if (linear) {
+        (*kernel)(sums.data(), rows.data(), contributor.getWeights(first + i),
+                  taps, n, scale);
+        linear->encodeRow(dst.getRow(i), sums.data(), dst.getWidth(),
+                          dst.getNComps(), dst.getBPC());
+      } else
+        (*kernel)(dst.getRow(i), rows.data(),
+                  contributor.getWeights(first + i), taps, n, scale);
+    }
+  });
+}
+
+// Vertical pass from the source, which must be float in linear light,
+// bands of output rows; the last pass goes through a row of float sums.
+void
+Resampler::resampleYSource (Image& dst, const Image& src,
+                            const ContribTable& contributor, bool last,
+                            int32_t first) const
+{
+  ConvolveRowYSource kernel = selectConvolveYSource(getResampleKernels(),
+                                                    src.getBPC(),
+                                                    contributor.getTaps());
+  int32_t taps  = contributor.getTaps();
+  int32_t n     = dst.getWidth() * dst.getNComps();
+  float   scale = 1.0 / sampleMaxValue(src.getBPC());
+
+  forBands(dst.getHeight(), [&](int32_t begin, int32_t end) {
+    std::vector<const void *> rows(taps);
+    std::vector<float> sums(last ? n : 0);
+    for (int32_t i = begin; i < end; i++) {
+      for (int32_t j = 0; j < taps; j++)
+        rows[j] = src.getRow(contributor.getStart(first + i) + j);
+      (*kernel)(last ? sums.data() : dst.getRowAs<float>(i), rows.data(),
+                contributor.getWeights(first + i), taps, n, scale);
+      if (last)
+        storeRow(dst, i, sums.data());
     }
+  });
+}
+
+void
+Resampler::copyRows (Image& dst, const Image& src, bool decoded) const
+{
+  forBands(dst.getHeight(), [&](int32_t begin, int32_t end) {
+    for (int32_t i = begin; i < end; i++) {
+      if (linear && !decoded)
+        linear->decodeRow(dst.getRowAs<float>(i), src.getRow(i),
+                          src.getWidth(), src.getNComps(), src.getBPC());
+      else
+        memcpy(dst.getRow(i), src.getRow(i), dst.getRowBytes());
+    }
+  });
+}
+
+// Encoded in linear light, otherwise rounded and clamped by a vertical
+// kernel of one tap.
+void
+Resampler::storeRow (Image& dst, int32_t i, const float *sums) const
+{
+  if (linear) {
+    linear->encodeRow(dst.getRow(i), sums, dst.getWidth(), dst.getNComps(),
+                      dst.getBPC());
+    return;
   }
+  static const float one = 1.0f;
+  ConvolveRowY kernel = selectConvolveY(getResampleKernels(), dst.getBPC(), 1);
+  (*kernel)(dst.getRow(i), &sums, &one, 1, dst.getWidth() * dst.getNComps(),
+            sampleMaxValue(dst.getBPC()));
 }
 
-#define MAP_IN_RANGE(A,L,H) ((A) <= (L) ? (L) : (A) <= (H) ? (A) : (H))
+// Horizontal pass of 8 bpc samples into the int16_t fixed point
+// intermediate, stored as a 16 bpc image.
 void
-Resampler::resampleX (Image& dst, const Image& src) const
-{
-  for (int32_t k = 0; k < dst.getHeight(); k++) {
-    for (int32_t i = 0; i < dst.getWidth(); i++) {
-      Color pixel;
-      for (int c = 0; c < src.getNComps(); c++) {
-        float weight = 0.0;
-        for (int j = 0; j < contributor[i].n; j++) {
-          weight +=
-            src.getPixel(contributor[i].p[j].pixel, k).v[c] *
-                                        contributor[i].p[j].weight;
+Resampler::resampleXFixed (Image& dst, const Image& src,
+                           const ContribTable& contributor) const
+{
+  ConvolveRowXFixed kernel = selectConvolveXFixed(getResampleKernels(),
+                                                  src.getNComps(),
+                                                  contributor.getTaps());
+
+  forBands(dst.getHeight(), [&](int32_t begin, int32_t end) {
+    for (int32_t k = begin; k < end; k++) {
+      (*kernel)(dst.getRowAs<int16_t>(k), src.getRow(k), dst.getWidth(),
+                contributor.getStart(), contributor.getFixedWeights(),
+                contributor.getTaps());
+    }
+  });
+}
+
+void
+Resampler::resampleYFixed (Image& dst, const Image& src,
+                           const ContribTable& contributor,
+                           int32_t first) const
+{
+  ConvolveRowYFixed kernel = selectConvolveYFixed(getResampleKernels(),
+                                                  contributor.getTaps());
+  int32_t taps = contributor.getTaps();
+
+  forBands(dst.getHeight(), [&](int32_t begin, int32_t end) {
+    std::vector<const int16_t *> rows(taps);
+    for (int32_t i = begin; i < end; i++) {
+      for (int32_t j = 0; j < taps; j++)
+        rows[j] = src.getRowAs<int16_t>(contributor.getStart(first + i) + j);
+      (*kernel)(dst.getRow(i), rows.data(),
+                contributor.getFixedWeights(first + i),
+                taps, dst.getWidth() * dst.getNComps());
+    }
+  });
+}
+
+// Each reduced row is the mean of a block of boxX by boxY source pixels,
+// rounded to the source sample type, or in linear light a float mean of
+// the decoded pixels.
+const Image&
+Resampler::boxReduce (const Image& src, const ResamplePlan& plan,
+                      Image& reduced) const
+{
+  int32_t kx = plan.getBoxX(), ky = plan.getBoxY();
+  if (kx == 1 && ky == 1)
+    return src;
+
+  StageTimer timer(stats, stage_shrink);
+  const struct ResampleKernels *kernels = getResampleKernels();
+  int8_t  bpc       = linear ? 32 : src.getBPC();
+  BoxRowY sumRows   = selectBoxY(kernels, bpc);
+  BoxRowX sumPixels = selectBoxX(kernels, bpc, src.getNComps(), kx);
+  float   scale     = 1.0f / (kx * ky);
+
+  reduced = Image(src.getWidth() / kx, src.getHeight() / ky,
+                  src.getNComps(), bpc);
+  int32_t n = src.getWidth() * src.getNComps();
+  forBands(reduced.getHeight(), [&](int32_t begin, int32_t end) {
+    std::vector<float> acc(n);
+    std::vector<float> row(linear ? n : 0);
+    for (int32_t i = begin; i < end; i++) {
+      std::fill(acc.begin(), acc.end(), 0.0f);
+      for (int32_t j = 0; j < ky; j++) {
+        const void *in = src.getRow(i * ky + j);
+        if (linear) {
+          linear->decodeRow(row.data(), in, src.getWidth(), src.getNComps(),
+                            src.getBPC());
+          in = row.data();
         }
-        pixel.v[c] = (uint16_t) MAP_IN_RANGE(weight, 0, 65535u);
+        (*sumRows)(acc.data(), in, n);
       }
-      dst.putPixel(i, k, pixel);
+      (*sumPixels)(reduced.getRow(i), acc.data(), reduced.getWidth(), kx,
+                   scale);
     }
+  });
+  return reduced;
+}
+
+// The intermediate image of the horizontal pass: float, or fixed point
+// for 8 bpc samples, held as 16 bpc.
+Image
+Resampler::horizontalPass (const Image& src, int32_t width,
+                           const ContribTable& contributor,
+                           bool decoded) const
+{
+  StageTimer timer(stats, stage_x);
+  // create intermediate image to hold horizontal zoom, kept in float so
+  // that no precision is lost between the two passes, or in fixed point
+  Image tmp(width, src.getHeight(), src.getNComps(),
+            isFixedPoint(src.getBPC()) ? 16 : 32);
+  if (tmp.getBPC() == 16)
+    resampleXFixed(tmp, src, contributor);
+  else
+    resampleX(tmp, src, contributor, decoded);
+  return tmp;
+}
+
+void
+Resampler::verticalPass (Image& dst, const Image& tmp,
+                         const ContribTable& contributor, int32_t first) const
+{
+  StageTimer timer(stats, stage_y);
+  if (tmp.getBPC() == 16)
+    resampleYFixed(dst, tmp, contributor, first);
+  else
+    resampleY(dst, tmp, contributor, first);
+}
+
+enum resample_passes_e
+Resampler::getPasses (const ResamplePlan& plan, int8_t bpc,
+                      bool decoded) const
+{
+  enum resample_passes_e passes = plan.getPasses();
+  if (passes == passes_yx) {
+    if (linear && !decoded)
+      return passes_xy;
+    if (isFixedPoint(bpc) &&
+        plan.getCost(false) * FIXED_POINT_COST <= plan.getCost(true))
+      return passes_xy;
   }
+  return passes;
 }
 
 void
-Resampler::resampleY (Image& dst, const Image& src) const
-{
-  for (int32_t k = 0; k < dst.getWidth(); k++) {
-    for (int32_t i = 0; i < dst.getHeight(); i++) {
-      Color pixel;
-      for (int c = 0; c < src.getNComps(); c++) {
-        float weight = 0.0;
-        for (int j = 0; j < contributor[i].n; j++) {
-          weight +=
-            src.getPixel(k, contributor[i].p[j].pixel).v[c] *
-                                           contributor[i].p[j].weight;
-        }
-        pixel.v[c] = (uint16_t) MAP_IN_RANGE(weight, 0, 65535u);
+Resampler::resamplePlanned (Image& dst, const Image& src,
+                            const ResamplePlan& plan) const
+{
+  Image reduced(0, 0, src.getNComps(), src.getBPC());
+  const Image& in = boxReduce(src, plan, reduced);
+  // A reduced image is decoded already.
+  bool decoded = &in != &src;
+  enum resample_passes_e passes = getPasses(plan, in.getBPC(), decoded);
+  recordPlan(plan, passes);
+
+  switch (passes) {
+  case passes_none:
+    for (int32_t i = 0; i < dst.getHeight(); i++)
+      memcpy(dst.getRow(i), src.getRow(i),
+             (size_t) dst.getWidth() * dst.getNComps() * (dst.getBPC() / 8));
+    break;
+  case passes_x:
+    {
+      StageTimer timer(stats, stage_x);
+      resampleX(dst, in, plan.getContributorX(), decoded, true);
+    }
+    break;
+  case passes_y:
+    {
+      StageTimer timer(stats, stage_y);
+      if (linear && !decoded) {
+        // The vertical pass reads float rows in linear light.
+        Image rows(in.getWidth(), in.getHeight(), in.getNComps(), 32);
+        copyRows(rows, in, false);
+        resampleYSource(dst, rows, plan.getContributorY(), true);
+      } else
+        resampleYSource(dst, in, plan.getContributorY(), true);
+    }
+    break;
+  case passes_yx:
+    {
+      // In float and, for linear light, decoded.
+      Image tmp(in.getWidth(), dst.getHeight(), in.getNComps(), 32);
+      {
+        StageTimer timer(stats, stage_y);
+        resampleYSource(tmp, in, plan.getContributorY(), false);
       }
-      dst.putPixel(k, i, pixel);
+      StageTimer timer(stats, stage_x);
+      resampleX(dst, tmp, plan.getContributorX(), true, true);
     }
+    break;
+  default:
+    {
+      Image tmp = horizontalPass(in, dst.getWidth(), plan.getContributorX(),
+                                 decoded);
+      verticalPass(dst, tmp, plan.getContributorY());
+    }
+    break;
   }
 }
 
 Image
-Resampler::resampleImage (const Image& src, float xsize, float ysize)
+Resampler::resampleImage (const Image& src, float xsize, float ysize) const
 {
-  float xScale, yScale;
-
   Image dst((uint32_t) xsize, (uint32_t) ysize, src.getNComps(), src.getBPC());
 
-  xScale = (float) xsize / (float) src.getWidth();
-  yScale = (float) ysize / (float) src.getHeight();
+  std::shared_ptr<const ResamplePlan> plan =
+      getPlan(src.getWidth(), src.getHeight(), dst.getWidth(), dst.getHeight());
+  resamplePlanned(dst, src, *plan);
 
-  // create intermediate image to hold horizontal zoom
-  Image tmp(dst.getWidth(), src.getHeight(), src.getNComps(), src.getBPC());
-  if (xScale < 1.0)
-    setupContributorForDownsample(xScale, dst.getWidth(), src.getWidth());
-  else
-    setupContributorForUpsample  (xScale, dst.getWidth(), src.getWidth());
-  resampleX(tmp, src);
+  return  dst;
+}
+
+std::vector<Image>
+Resampler::resampleImages (const Image& src,
+                           const std::vector<ResampleSize>& sizes) const
+{
+  std::vector<Image> dst;
+  for (size_t t = 0; t < sizes.size(); t++)
+    dst.push_back(Image(sizes[t].width, sizes[t].height,
+                        src.getNComps(), src.getBPC()));
+
+  // The horizontal pass depends on the width and the box reduction only;
+  // one intermediate image at a time serves every target that has them in
+  // common and runs that pass first anyway, so that each target comes out
+  // as resampleImage() would make it.
+  std::vector<std::shared_ptr<const ResamplePlan> > plans;
+  std::vector<bool> done(sizes.size(), false);
+  std::vector<bool> sharable(sizes.size());
+  for (size_t t = 0; t < sizes.size(); t++) {
+    plans.push_back(getPlan(src.getWidth(), src.getHeight(),
+                            sizes[t].width, sizes[t].height));
+    bool boxed = plans[t]->getBoxX() > 1 || plans[t]->getBoxY() > 1;
+    sharable[t] = getPasses(*plans[t], src.getBPC(), boxed) == passes_xy;
+  }
+  for (size_t t = 0; t < sizes.size(); t++) {
+    if (done[t])
+      continue;
+    size_t shared = 0;
+    for (size_t u = t + 1; u < sizes.size() && sharable[t]; u++) {
+      if (!done[u] && sharable[u] && sizes[u].width == sizes[t].width &&
+          plans[u]->getBoxX() == plans[t]->getBoxX() &&
+          plans[u]->getBoxY() == plans[t]->getBoxY())
+        shared++;
+    }
+    if (shared == 0) {
+      resamplePlanned(dst[t], src, *plans[t]);
+      done[t] = true;
+      continue;
+    }
+
+    Image reduced(0, 0, src.getNComps(), src.getBPC());
+    const Image& in = boxReduce(src, *plans[t], reduced);
+    Image tmp = horizontalPass(in, sizes[t].width, plans[t]->getContributorX(),
+                               &in != &src);
+    for (size_t u = t; u < sizes.size(); u++) {
+      if (done[u] || !sharable[u] || sizes[u].width != sizes[t].width ||
+          plans[u]->getBoxX() != plans[t]->getBoxX() ||
+          plans[u]->getBoxY() != plans[t]->getBoxY())
+        continue;
+      recordPlan(*plans[u], passes_xy);
+      verticalPass(dst[u], tmp, plans[u]->getContributorY());
+      done[u] = true;
+    }
+  }
+
+  return dst;
+}
+
+namespace {
+// One output of resampleStream(). Source rows are pushed in order, are
+// box reduced as they come if the plan has a box reduction, go through
+// the horizontal pass into a ring of rows just deep enough for the
+// vertical windows, and every output row is written to the sink as soon
+// as its window is complete. In linear light, rows are decoded as they
+// come and encoded as they go. The passes are those resampleImage() runs,
+// in its order: without the vertical pass each row goes out as it comes;
+// with the vertical pass first, or alone, the ring holds the reduced
+// source rows and each output row is made from them, then goes through
+// the horizontal pass if any.
+class StreamTarget
+{
+public:
+  StreamTarget(std::shared_ptr<const ResamplePlan> plan, RowSink *sink,
+               int8_t nComps, int8_t bpc, enum resample_passes_e passes,
+               bool fixed, ResampleStats *stats, const LinearLight *linear);
+
+  // Take the next source row. Returns false if the sink failed.
+  bool push(const uint8_t *row);
 
-  if (yScale < 1.0)
-    setupContributorForDownsample(yScale, dst.getHeight(), src.getHeight());
+private:
+  void emit(int32_t i);
+  // The float sums into the output row.
+  void store();
+
+  std::shared_ptr<const ResamplePlan> plan;
+  enum resample_passes_e passes;
+  bool     sourceRing; // of reduced source rows, for the vertical pass first
+  int32_t  boxX, boxY;
+  const ContribTable& cx;
+  const ContribTable& cy;
+  RowSink *sink;
+  int32_t  nComps;
+  bool     fixed;
+  ResampleStats *stats;
+  const LinearLight *linear;
+  int8_t   bpc;
+
+  ConvolveRowX      kernelX;
+  ConvolveRowX      kernelXFloat; // after the vertical pass
+  ConvolveRowY      kernelY;
+  ConvolveRowXFixed kernelXFixed;
+  ConvolveRowYFixed kernelYFixed;
+  ConvolveRowYSource kernelYSource;
+  ConvolveRowY      kernelStore;
+  BoxRowY           kernelBoxY;
+  BoxRowX           kernelBoxX;
+  float             scaleX, scaleY;
+
+  std::vector<float> decoded; // source row in linear light
+  std::vector<float> sums;    // output row in linear light or of one pass
+  std::vector<float> middle;  // row of the vertical pass first
+  std::vector<float> boxSums; // of the last boxRows source rows
+  int32_t boxRows;
+  Image   reduced;
+
+  int32_t height;  // output rows
+  int32_t depth;
+  Image   ring;
+  Image   out;
+  int32_t next;    // next source row
+  int32_t nextOut; // next output row
+  std::vector<const float *>   rows;
+  std::vector<const int16_t *> fixedRows;
+  std::vector<const void *>    sourceRows;
+};
+
+StreamTarget::StreamTarget (std::shared_ptr<const ResamplePlan> plan,
+                            RowSink *sink, int8_t nComps, int8_t bpc,
+                            enum resample_passes_e passes, bool fixed,
+                            ResampleStats *stats,
+                            const LinearLight *linear) :
+  plan(plan), passes(passes),
+  sourceRing(passes == passes_y || passes == passes_yx),
+  cx(plan->getContributorX()), cy(plan->getContributorY()),
+  reduced(plan->getSrcWidth() / plan->getBoxX(), 1, nComps,
+          linear ? 32 : bpc),
+  ring(sourceRing ? reduced.getWidth() : plan->getDstWidth(),
+       passes == passes_x || passes == passes_none ? 0 : cy.getSpan(),
+       nComps, sourceRing ? reduced.getBPC() : fixed ? 16 : 32),
+  out(plan->getDstWidth(), 1, nComps, bpc)
+{
+  const struct ResampleKernels *kernels = getResampleKernels();
+  // Kernels see floats between decoding and encoding.
+  int8_t inner = linear ? 32 : bpc;
+
+  this->sink   = sink;
+  this->nComps = nComps;
+  this->fixed  = fixed;
+  this->stats  = stats;
+  this->linear = linear;
+  this->bpc    = bpc;
+  kernelX      = selectConvolveX(kernels, inner, nComps, cx.getTaps());
+  kernelXFloat = selectConvolveX(kernels, 32, nComps, cx.getTaps());
+  kernelY      = selectConvolveY(kernels, inner, cy.getTaps());
+  kernelXFixed = selectConvolveXFixed(kernels, nComps, cx.getTaps());
+  kernelYFixed = selectConvolveYFixed(kernels, cy.getTaps());
+  kernelYSource = selectConvolveYSource(kernels, inner, cy.getTaps());
+  kernelStore  = selectConvolveY(kernels, bpc, 1);
+  boxX         = plan->getBoxX();
+  boxY         = plan->getBoxY();
+  kernelBoxY   = selectBoxY(kernels, inner);
+  kernelBoxX   = selectBoxX(kernels, inner, nComps, boxX);
+  scaleX       = 1.0 / sampleMaxValue(inner);
+  scaleY       = sampleMaxValue(inner);
+  if (linear)
+    decoded.resize(plan->getSrcWidth() * nComps);
+  if (linear || passes != passes_xy)
+    sums.resize(plan->getDstWidth() * nComps);
+  if (passes == passes_yx)
+    middle.resize(reduced.getWidth() * nComps);
+  height       = plan->getDstHeight();
+  depth        = cy.getSpan();
+  next = nextOut = 0;
+  rows.resize(cy.getTaps());
+  fixedRows.resize(cy.getTaps());
+  sourceRows.resize(cy.getTaps());
+  boxSums.resize(plan->getSrcWidth() * nComps);
+  boxRows = 0;
+}
+
+bool
+StreamTarget::push (const uint8_t *row)
+{
+  int32_t width = out.getWidth();
+  int32_t taps  = cy.getTaps();
+
+  // Rows past the last window are not needed.
+  if (nextOut == height)
+    return true;
+
+  if (passes == passes_none) {
+    nextOut++;
+    return sink->writeRow(row);
+  }
+
+  if (linear) {
+    StageTimer timer(stats, stage_x);
+    linear->decodeRow(decoded.data(), row, plan->getSrcWidth(), nComps, bpc);
+    row = reinterpret_cast<const uint8_t *>(decoded.data());
+  }
+
+  if (boxX > 1 || boxY > 1) {
+    StageTimer timer(stats, stage_shrink);
+    (*kernelBoxY)(boxSums.data(), row, (int32_t) boxSums.size());
+    if (++boxRows < boxY)
+      return true;
+    (*kernelBoxX)(reduced.getRow(0), boxSums.data(), reduced.getWidth(), boxX,
+                  1.0f / (boxX * boxY));
+    std::fill(boxSums.begin(), boxSums.end(), 0.0f);
+    boxRows = 0;
+    row = reduced.getRow(0);
+  }
+
+  if (passes == passes_x) {
+    {
+      StageTimer timer(stats, stage_x);
+      (*kernelX)(sums.data(), row, width, cx.getStart(), cx.getWeights(),
+                 cx.getTaps(), scaleX);
+      store();
+    }
+    nextOut++;
+    return sink->writeRow(out.getRow(0));
+  }
+
+  // Slot next % depth holds a row older than any window from here on.
+  if (sourceRing)
+    memcpy(ring.getRow(next % depth), row, ring.getRowBytes());
+  else {
+    StageTimer timer(stats, stage_x);
+    if (fixed)
+      (*kernelXFixed)(ring.getRowAs<int16_t>(next % depth), row, width,
+                      cx.getStart(), cx.getFixedWeights(), cx.getTaps());
+    else
+      (*kernelX)(ring.getRowAs<float>(next % depth), row, width,
+                 cx.getStart(), cx.getWeights(), cx.getTaps(), scaleX);
+  }
+  next++;
+
+  while (nextOut < height && cy.getStart(nextOut) + taps <= next) {
+    emit(nextOut++);
+    if (!sink->writeRow(out.getRow(0)))
+      return false;
+  }
+  return true;
+}
+
+void
+StreamTarget::emit (int32_t i)
+{
+  int32_t first = cy.getStart(i);
+  int32_t taps  = cy.getTaps();
+  int32_t n     = out.getWidth() * nComps;
+
+  // As resampleYSource(), then resampleX() of the float row.
+  if (sourceRing) {
+    float *row = passes == passes_yx ? middle.data() : sums.data();
+    {
+      StageTimer timer(stats, stage_y);
+      for (int32_t j = 0; j < taps; j++)
+        sourceRows[j] = ring.getRow((first + j) % depth);
+      (*kernelYSource)(row, sourceRows.data(), cy.getWeights(i), taps,
+                       ring.getWidth() * nComps, scaleX);
+    }
+    StageTimer timer(stats, passes == passes_yx ? stage_x : stage_y);
+    if (passes == passes_yx)
+      (*kernelXFloat)(sums.data(), row, out.getWidth(), cx.getStart(),
+                      cx.getWeights(), cx.getTaps(), 1.0f);
+    store();
+    return;
+  }
+
+  StageTimer timer(stats, stage_y);
+  if (fixed) {
+    for (int32_t j = 0; j < taps; j++)
+      fixedRows[j] = ring.getRowAs<int16_t>((first + j) % depth);
+    (*kernelYFixed)(out.getRow(0), fixedRows.data(), cy.getFixedWeights(i),
+                    taps, n);
+  } else {
+    for (int32_t j = 0; j < taps; j++)
+      rows[j] = ring.getRowAs<float>((first + j) % depth);
+    if (linear) {
+      (*kernelY)(sums.data(), rows.data(), cy.getWeights(i), taps, n, scaleY);
+      linear->encodeRow(out.getRow(0), sums.data(), out.getWidth(), nComps,
+                        bpc);
+    } else
+      (*kernelY)(out.getRow(0), rows.data(), cy.getWeights(i), taps, n,
+                 scaleY);
+  }
+}
+
+// As Resampler::storeRow().
+void
+StreamTarget::store ()
+{
+  static const float one = 1.0f;
+  const float *row = sums.data();
+
+  if (linear)
+    linear->encodeRow(out.getRow(0), row, out.getWidth(), nComps, bpc);
   else
-    setupContributorForUpsample  (yScale, dst.getHeight(), src.getHeight());
-  resampleY(dst, tmp);
+    (*kernelStore)(out.getRow(0), &row, &one, 1, out.getWidth() * nComps,
+                   sampleMaxValue(bpc));
+}
+}
 
-  return  dst;
+int
+Resampler::resampleStream (RowSource& src, RowSink& dst,
+                           int32_t xsize, int32_t ysize) const
+{
+  ResampleSink target = { &dst, xsize, ysize };
+  return resampleStream(src, std::vector<ResampleSink>(1, target));
+}
+
+int
+Resampler::resampleStream (RowSource& src,
+                           const std::vector<ResampleSink>& sinks) const
+{
+  std::vector<std::unique_ptr<StreamTarget> > targets;
+  for (size_t t = 0; t < sinks.size(); t++) {
+    std::shared_ptr<const ResamplePlan> plan =
+        getPlan(src.getWidth(), src.getHeight(),
+                sinks[t].width, sinks[t].height);
+    // The passes of resampleImage(), in fixed point where it would be.
+    bool boxed = plan->getBoxX() > 1 || plan->getBoxY() > 1;
+    enum resample_passes_e passes = getPasses(*plan, src.getBPC(), boxed);
+    bool fixed = isFixedPoint(src.getBPC()) && passes == passes_xy;
+    recordPlan(*plan, passes);
+    targets.push_back(std::unique_ptr<StreamTarget>(
+        new StreamTarget(plan, sinks[t].sink, src.getNComps(), src.getBPC(),
+                         passes, fixed, stats, linear.get())));
+  }
+
+  Image in(src.getWidth(), 1, src.getNComps(), src.getBPC());
+  for (int32_t y = 0; y < src.getHeight(); y++) {
+    if (!src.readRow(in.getRow(0)))
+      return -1;
+    for (size_t t = 0; t < targets.size(); t++) {
+      if (!targets[t]->push(in.getRow(0)))
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+// Without a vertical pass every output row comes from its source row
+// alone: bands of rows go through the horizontal pass, if any, straight
+// to dst.
+int
+Resampler::resampleBands (RowSource& src, RowSink& dst,
+                          const ResamplePlan& plan, size_t bandRows) const
+{
+  int8_t nComps = src.getNComps();
+  int8_t bpc    = src.getBPC();
+  bool   copy   = plan.getPasses() == passes_none;
+
+  bandRows = std::max(std::min(bandRows, (size_t) src.getHeight()),
+                      (size_t) 1);
+  Image band(src.getWidth(), bandRows, nComps, bpc);
+  Image outBand(copy ? 0 : plan.getDstWidth(), bandRows, nComps, bpc);
+  for (int32_t y = 0; y < src.getHeight(); y += bandRows) {
+    int32_t rows = std::min((int32_t) bandRows, src.getHeight() - y);
+    for (int32_t j = 0; j < rows; j++) {
+      if (!src.readRow(band.getRow(j)))
+        return -1;
+    }
+    Image in(src.getWidth(), rows, nComps, bpc, band.getRow(0),
+             band.getStride());
+    Image out(plan.getDstWidth(), rows, nComps, bpc, outBand.getRow(0),
+              outBand.getStride());
+    if (!copy) {
+      Image reduced(0, 0, nComps, bpc);
+      const Image& part = boxReduce(in, plan, reduced);
+      StageTimer timer(stats, stage_x);
+      resampleX(out, part, plan.getContributorX(), &part != &in, true);
+    }
+    for (int32_t j = 0; j < rows; j++) {
+      if (!dst.writeRow(copy ? in.getRow(j) : out.getRow(j)))
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+int
+Resampler::resampleTiled (RowSource& src, RowSink& dst,
+                          int32_t xsize, int32_t ysize, size_t memoryLimit,
+                          const std::string& scratchDir) const
+{
+  std::shared_ptr<const ResamplePlan> plan =
+      getPlan(src.getWidth(), src.getHeight(), xsize, ysize);
+  const ContribTable& cx = plan->getContributorX();
+  const ContribTable& cy = plan->getContributorY();
+  int8_t  nComps = src.getNComps();
+  int8_t  bpc    = src.getBPC();
+  int32_t boxY   = plan->getBoxY();
+  size_t  srcRowBytes = (size_t) src.getWidth() * nComps * (bpc / 8);
+  // Reduced rows are float in linear light.
+  size_t  reducedRowBytes = (size_t) src.getWidth() / plan->getBoxX() *
+                            nComps * ((linear ? 32 : bpc) / 8);
+  size_t  dstRowBytes = (size_t) xsize * nComps * (bpc / 8);
+
+  // The passes of resampleImage(), in its order.
+  bool boxed = plan->getBoxX() > 1 || boxY > 1;
+  enum resample_passes_e passes = getPasses(*plan, bpc, boxed);
+  bool sourceFirst = passes == passes_y || passes == passes_yx;
+  recordPlan(*plan, passes);
+  if (passes == passes_none || passes == passes_x)
+    return resampleBands(src, dst, *plan, memoryLimit /
+                         (srcRowBytes + reducedRowBytes + dstRowBytes));
+
+  // The intermediate image, rows of the source after the box reduction
+  // and the horizontal pass, or only the reduction (decoded in linear
+  // light) when the vertical pass comes first.
+  int32_t width  = sourceFirst ? src.getWidth() / plan->getBoxX() : xsize;
+  int8_t  tmpBPC = sourceFirst ? (linear ? 32 : bpc) :
+                   isFixedPoint(bpc) ? 16 : 32;
+  int32_t height = src.getHeight() / boxY;
+  size_t  stride = ((size_t) width * nComps * (tmpBPC / 8) +
+                    ALIGNED_ALLOC_ALIGN - 1) /
+                    ALIGNED_ALLOC_ALIGN * ALIGNED_ALLOC_ALIGN;
+  size_t  bytes  = stride * height;
+  std::unique_ptr<ScratchFile> scratch;
+  Image   tmp(0, 0, nComps, tmpBPC);
+  if (bytes <= memoryLimit / 2) {
+    tmp = Image(width, height, nComps, tmpBPC);
+    memoryLimit -= bytes;
+  } else {
+    scratch.reset(new ScratchFile(bytes, scratchDir));
+    if (!scratch->valid())
+      return -1;
+    tmp = Image(width, height, nComps, tmpBPC, scratch->getData(), stride);
+  }
+
+  // A source row of a band costs its pixels, its share of a reduced row
+  // and of the intermediate row written to the scratch file; an output
+  // row of a strip its pixels and the intermediate rows its windows read.
+  // Bands are whole blocks of the box reduction, so that they are reduced
+  // as the whole image would be.
+  size_t fileBytes = scratch ? stride : 0;
+  size_t bandRows  = memoryLimit /
+                     (srcRowBytes + (reducedRowBytes + fileBytes) / boxY) /
+                     boxY * boxY;
+  bandRows = std::max(std::min(bandRows, (size_t) src.getHeight()),
+                      (size_t) boxY);
+  {
+    Image band(src.getWidth(), bandRows, nComps, bpc);
+    for (int32_t y = 0; y < src.getHeight(); y += bandRows) {
+      int32_t rows = std::min((int32_t) bandRows, src.getHeight() - y);
+      for (int32_t j = 0; j < rows; j++) {
+        if (!src.readRow(band.getRow(j)))
+          return -1;
+      }
+      Image in(src.getWidth(), rows, nComps, bpc, band.getRow(0),
+               band.getStride());
+      Image reduced(0, 0, nComps, bpc);
+      const Image& part = boxReduce(in, *plan, reduced);
+      Image out(width, part.getHeight(), nComps, tmpBPC,
+                tmp.getRow(y / boxY), tmp.getStride());
+      if (sourceFirst)
+        copyRows(out, part, &part != &in);
+      else {
+        StageTimer timer(stats, stage_x);
+        if (tmpBPC == 16)
+          resampleXFixed(out, part, cx);
+        else
+          resampleX(out, part, cx, &part != &in);
+      }
+      if (scratch)
+        scratch->release(tmp.getRow(y / boxY) - tmp.getRow(0),
+                         part.getHeight() * stride);
+    }
+  }
+
+  // Intermediate rows before the windows of output i and later may go.
+  std::vector<int32_t> low(ysize + 1, height);
+  for (int32_t i = ysize - 1; i >= 0; i--)
+    low[i] = std::min(low[i + 1], cy.getStart(i));
+
+  // With the vertical pass first, a strip also takes a float row of it.
+  size_t middleRowBytes = passes == passes_yx ?
+                          (size_t) width * nComps * sizeof(float) : 0;
+  size_t halo = fileBytes * cy.getSpan();
+  size_t stripRows = (memoryLimit > halo ? memoryLimit - halo : 0) /
+                     (dstRowBytes + middleRowBytes +
+                      fileBytes * height / ysize + 1);
+  stripRows = std::max(std::min(stripRows, (size_t) ysize), (size_t) 1);
+  Image strip(xsize, stripRows, nComps, bpc);
+  Image middle(middleRowBytes ? width : 0, stripRows, nComps, 32);
+  for (int32_t i = 0; i < ysize; i += stripRows) {
+    int32_t rows = std::min((int32_t) stripRows, ysize - i);
+    Image out(xsize, rows, nComps, bpc, strip.getRow(0), strip.getStride());
+    if (passes == passes_yx) {
+      Image part(width, rows, nComps, 32, middle.getRow(0),
+                 middle.getStride());
+      {
+        StageTimer timer(stats, stage_y);
+        resampleYSource(part, tmp, cy, false, i);
+      }
+      StageTimer timer(stats, stage_x);
+      resampleX(out, part, cx, true, true);
+    } else if (passes == passes_y) {
+      StageTimer timer(stats, stage_y);
+      resampleYSource(out, tmp, cy, true, i);
+    } else
+      verticalPass(out, tmp, cy, i);
+    for (int32_t j = 0; j < rows; j++) {
+      if (!dst.writeRow(out.getRow(j)))
+        return -1;
+    }
+    if (scratch)
+      scratch->release(tmp.getRow(low[i]) - tmp.getRow(0),
+                       (size_t) (low[i + rows] - low[i]) * stride);
+  }
+
+  return 0;
 }
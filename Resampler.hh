@@ -4,56 +4,198 @@
 #ifndef __RESAMPLER_HH__
 #define __RESAMPLER_HH__
 
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 #include "Image.hh"
+#include "ResamplePlan.hh"
 
-typedef struct
-{
-  int32_t pixel;
-  float   weight;
-} Contrib;
+class LinearLight;
+class ResampleStats;
+class RowSource;
+class RowSink;
+class ThreadPool;
 
-typedef struct
+// Output size for resampleImages().
+struct ResampleSize
 {
-  int      n;
-  std::vector<Contrib> p;
-} ContribList;
+  int32_t width;
+  int32_t height;
+};
 
-struct filterItem
+// Output of resampleStream() to several sinks.
+struct ResampleSink
 {
-  const char name[32];
-  float (*func)(float);
-  float support;
+  RowSink *sink;
+  int32_t  width;
+  int32_t  height;
 };
 
+// A Resampler holds no per-image state: resampleImage() may be called from
+// several threads at once. Contributor tables come from a ResamplePlanCache,
+// the process wide one unless another is given. With a ThreadPool the
+// passes are split into bands of rows; the result does not depend on it.
 class Resampler
 {
 public:
   Resampler ();
   Resampler (const std::string& filter);
+  Resampler (const std::string& filter, ResamplePlanCache& cache);
   ~Resampler();
 
-  Image resampleImage(const Image& src, float xsize, float ysize);
+  // The passes run in the order the plan finds cheaper, see
+  // ResamplePlan::getPasses(), and only along the axes that change.
+  Image resampleImage(const Image& src, float xsize, float ysize) const;
+  // Several sizes of one source, in the order given, each as
+  // resampleImage() makes it. Sizes of the same width whose plans run the
+  // horizontal pass first share it.
+  std::vector<Image> resampleImages(const Image& src,
+                                    const std::vector<ResampleSize>& sizes)
+                                    const;
+
+  // Same result as resampleImage(), byte for byte, reading src and writing
+  // xsize by ysize rows of the source sample type to dst one at a time:
+  // the same passes run in the same order. Memory use is a few rows,
+  // independent of the image heights. Runs on the calling thread. Returns
+  // 0 on success, -1 if a row could not be read or written.
+  int   resampleStream(RowSource& src, RowSink& dst,
+                       int32_t xsize, int32_t ysize) const;
+  // The same to every sink, reading src once.
+  int   resampleStream(RowSource& src,
+                       const std::vector<ResampleSink>& sinks) const;
+
+  // Same result as resampleImage(), byte for byte, for images too large
+  // for memory, on the thread pool. Source rows are read in bands, each
+  // band overlapping no other, through the horizontal pass into the
+  // intermediate image; if that takes more than half of memoryLimit bytes
+  // it is kept in a ScratchFile in scratchDir. Strips of output rows are
+  // then made from it, each reading the intermediate rows of its windows,
+  // and written to dst. When the vertical pass comes first, or alone, the
+  // intermediate image holds the reduced source rows and the strips go
+  // through the horizontal pass after it; without a vertical pass the
+  // bands go straight to dst. The bands and strips share the rest of
+  // memoryLimit. Returns 0 on success, -1 if a row could not be read or
+  // written or the scratch file could not be made.
+  int   resampleTiled(RowSource& src, RowSink& dst,
+                      int32_t xsize, int32_t ysize, size_t memoryLimit,
+                      const std::string& scratchDir = "") const;
+
+  // Run resampleImage() on the threads of pool, or on the calling thread
+  // only if NULL (the default). The pool must outlive its use here.
+  void  setThreadPool(ThreadPool *pool) { this->pool = pool; };
+  ThreadPool *getThreadPool() const { return pool; };
+
+  // Charge the time of each stage to stats and record the plans used, or
+  // nothing if NULL (the default). The stats must outlive their use here.
+  void  setStats(ResampleStats *stats) { this->stats = stats; };
+  ResampleStats *getStats() const { return stats; };
+
+  // 8 bpc images are resampled in fixed point, within 1 of the floating
+  // point result, unless turned off here (on by default).
+  void  setFixedPoint(bool enable) { fixedPoint = enable; };
+  bool  getFixedPoint() const { return fixedPoint; };
+
+  // Filter in linear light: samples are decoded with curve where they are
+  // first read, by the box reduction or the horizontal pass, and encoded
+  // again as the vertical pass writes them; in between they are float.
+  // NULL (the default) filters the encoded values. Fixed point is not
+  // used then.
+  void  setLinearLight(std::shared_ptr<const LinearLight> curve)
+    { linear = curve; };
+  std::shared_ptr<const LinearLight> getLinearLight() const { return linear; };
+
+  // Large reductions start with an integer box reduction where the plan
+  // finds one if turned on here (off by default): faster, but not the
+  // result of the filter alone, see BOX_MIN_RATIO. Never in linear light,
+  // where encoding magnifies the difference near black.
+  void  setShrinkOnLoad(bool enable) { shrinkOnLoad = enable; };
+  bool  getShrinkOnLoad() const { return shrinkOnLoad; };
+
+  // Plan for resampling images of the given size with this filter. Plans
+  // are recorded in the stats as they are used.
+  std::shared_ptr<const ResamplePlan> getPlan(int32_t srcWidth,
+                                              int32_t srcHeight,
+                                              int32_t dstWidth,
+                                              int32_t dstHeight) const;
 
 private:
-  float (*filter_fn)(float);
-  float support;
-  std::vector<ContribList> contributor;
-
-  void resampleX(Image& dst, const Image& src) const;
-  void resampleY(Image& dst, const Image& src) const;
-  void setupContributorForDownsample (float scale,
-                                      int32_t dstSize, int32_t boundary);
-  void setupContributorForUpsample   (float scale,
-                                      int32_t dstSize, int32_t boundary);
-
-  static float box_filter(float);
-  static float bilinear_filter(float);
-  static float B_spline_filter(float);
-  static float bicubic_filter(float) ;
-  static float Lanczos3_filter(float);
-  static float Mitchell_filter(float);
+  // Times the passes one at a time, see bench.cc.
+  friend class ResampleBench;
+
+  const struct filterItem *filter;
+  ResamplePlanCache       *cache;
+  ThreadPool              *pool;
+  ResampleStats           *stats;
+  bool                     fixedPoint;
+  bool                     shrinkOnLoad;
+  std::shared_ptr<const LinearLight> linear;
+
+  bool isFixedPoint(int8_t bpc) const
+    { return fixedPoint && bpc == 8 && !linear; };
+
+  // Call body(begin, end) over 0 <= i < count, split over the pool.
+  void forBands(int32_t count,
+                const std::function<void(int32_t, int32_t)>& body) const;
+
+  // src, or src box reduced into reduced as the plan asks; in linear
+  // light, reduced is float and already decoded.
+  const Image& boxReduce(const Image& src, const ResamplePlan& plan,
+                         Image& reduced) const;
+  // dst from src by plan, in the order of getPasses().
+  void  resamplePlanned(Image& dst, const Image& src,
+                        const ResamplePlan& plan) const;
+  // The passes of plan as they can run on a source of bpc bits, decoded
+  // or not: in linear light the vertical pass comes first only on source
+  // rows that are float already, and the horizontal pass first in fixed
+  // point may beat the other order in float, see FIXED_POINT_COST. Every
+  // path runs these, so that all give the same result.
+  enum resample_passes_e getPasses(const ResamplePlan& plan, int8_t bpc,
+                                   bool decoded) const;
+  void  recordPlan(const ResamplePlan& plan,
+                   enum resample_passes_e passes) const;
+  // resampleTiled() for a plan without a vertical pass, bandRows source
+  // rows at a time.
+  int   resampleBands(RowSource& src, RowSink& dst, const ResamplePlan& plan,
+                      size_t bandRows) const;
+
+  // decoded tells that src is in linear light already.
+  Image horizontalPass(const Image& src, int32_t width,
+                       const ContribTable& contributor,
+                       bool decoded = false) const;
+  // Output rows first, first + 1, ... of contributor into dst.
+  void  verticalPass(Image& dst, const Image& tmp,
+                     const ContribTable& contributor, int32_t first = 0) const;
+
+  // last tells that dst is the output, of any sample type, rather than
+  // the float intermediate.
+  void resampleX(Image& dst, const Image& src,
+                 const ContribTable& contributor, bool decoded = false,
+                 bool last = false) const;
+  void resampleY(Image& dst, const Image& src,
+                 const ContribTable& contributor, int32_t first = 0) const;
+  // Vertical pass from the rows of the source, when it comes first or
+  // alone.
+  void resampleYSource(Image& dst, const Image& src,
+                       const ContribTable& contributor, bool last,
+                       int32_t first = 0) const;
+  // Rows of src into dst of the same size, decoded to float in linear
+  // light unless decoded tells they are already.
+  void copyRows(Image& dst, const Image& src, bool decoded) const;
+  // Float sums, 1.0 full scale, into row i of the output.
+  void storeRow(Image& dst, int32_t i, const float *sums) const;
+  void resampleXFixed(Image& dst, const Image& src,
+                      const ContribTable& contributor) const;
+  void resampleYFixed(Image& dst, const Image& src,
+                      const ContribTable& contributor, int32_t first = 0) const;
+
+  static const struct filterItem *findFilter(const std::string& name);
+
+  static float box_filter(float, float, float);
+  static float bilinear_filter(float, float, float);
+  static float cubic_filter(float, float B, float C);
+  static float Lanczos_filter(float, float lobes, float);
+  static float Gaussian_filter(float, float sigma, float);
 
   static const struct filterItem filters[];
   static const int NUM_FILTERS;
@@ -0,0 +1,65 @@
+#ifndef __ROWSTREAM_HH__
+#define __ROWSTREAM_HH__
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Image.hh"
+
+// Sequential access to the rows of an image, top to bottom. A row holds
+// width * nComps interleaved samples in the same types as Image: uint8_t,
+// uint16_t in host byte order, or float.
+class RowSource
+{
+public:
+  virtual ~RowSource() {};
+
+  virtual int32_t getWidth()  const = 0;
+  virtual int32_t getHeight() const = 0;
+  virtual int8_t  getNComps() const = 0;
+  virtual int8_t  getBPC()    const = 0;
+
+  // Read the next row. Returns false on error or past the last row.
+  virtual bool readRow(void *row) = 0;
+};
+
+// Receives rows top to bottom; the size and sample type are fixed by
+// whoever creates the sink.
+class RowSink
+{
+public:
+  virtual ~RowSink() {};
+
+  // Write the next row. Returns false on error.
+  virtual bool writeRow(const void *row) = 0;
+
+  // Finish after the last row. Returns 0 on success, -1 on error or if
+  // rows are missing.
+  virtual int close() { return 0; };
+};
+
+// The rows of an image in memory, as a RowSource.
+class ImageRowSource : public RowSource
+{
+public:
+  ImageRowSource(const Image& image) : image(image), next(0) {};
+
+  virtual int32_t getWidth()  const { return image.getWidth(); };
+  virtual int32_t getHeight() const { return image.getHeight(); };
+  virtual int8_t  getNComps() const { return image.getNComps(); };
+  virtual int8_t  getBPC()    const { return image.getBPC(); };
+
+  virtual bool readRow(void *row)
+  {
+    if (next >= image.getHeight())
+      return false;
+    memcpy(row, image.getRow(next++), image.getRowBytes());
+    return true;
+  };
+
+private:
+  const Image& image;
+  int32_t      next;
+};
+
+#endif // __ROWSTREAM_HH__
@@ -0,0 +1,55 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <string>
+#include <vector>
+
+#include "ScratchFile.hh"
+
+ScratchFile::ScratchFile (size_t size, const std::string& dir)
+{
+  this->size = size;
+  data = NULL;
+
+  std::string path = dir;
+  if (path.empty()) {
+    const char *tmpdir = getenv("TMPDIR");
+    path = tmpdir && *tmpdir ? tmpdir : "/tmp";
+  }
+  path += "/resample-XXXXXX";
+
+  std::vector<char> name(path.begin(), path.end());
+  name.push_back('\0');
+  int fd = mkstemp(name.data());
+  if (fd < 0)
+    return;
+  unlink(name.data());
+
+  if (size > 0 && ftruncate(fd, (off_t) size) == 0) {
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED)
+      data = static_cast<uint8_t *>(map);
+  }
+  // The mapping keeps the file open.
+  close(fd);
+}
+
+ScratchFile::~ScratchFile ()
+{
+  if (data)
+    munmap(data, size);
+}
+
+void
+ScratchFile::release (size_t offset, size_t length)
+{
+  size_t page  = (size_t) sysconf(_SC_PAGESIZE);
+  size_t begin = (offset + page - 1) / page * page;
+  size_t end   = (offset + length) / page * page;
+
+  if (!data || begin >= end)
+    return;
+  // Dirty pages of a shared file mapping are written back, not lost.
+  madvise(data + begin, end - begin, MADV_DONTNEED);
+}
@@ -0,0 +1,35 @@
+#ifndef __SCRATCHFILE_HH__
+#define __SCRATCHFILE_HH__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+
+// A temporary file mapped into memory, for data that need not fit in RAM:
+// pages are written back to the file and read in again as the system
+// needs. The file is unlinked as soon as it is created, in dir or else
+// $TMPDIR or /tmp, and disappears with the object.
+class ScratchFile
+{
+public:
+  ScratchFile(size_t size, const std::string& dir = "");
+  ~ScratchFile();
+
+  bool     valid() const { return data != NULL; };
+  size_t   getSize() const { return size; };
+  uint8_t *getData() { return data; };
+
+  // Drop the pages wholly inside offset to offset + length from memory;
+  // their contents stay in the file.
+  void release(size_t offset, size_t length);
+
+private:
+  ScratchFile(const ScratchFile&);
+  ScratchFile& operator=(const ScratchFile&);
+
+  size_t   size;
+  uint8_t *data;
+};
+
+#endif // __SCRATCHFILE_HH__
@@ -0,0 +1,119 @@
+#include <atomic>
+#include <memory>
+
+#include "ThreadPool.hh"
+
+// Bands per thread, so that uneven bands still balance.
+#define BANDS_PER_THREAD 4
+
+ThreadPool::ThreadPool (int32_t threads)
+{
+  stopping = false;
+  if (threads <= 0)
+    threads = hardwareThreads();
+  for (int32_t i = 1; i < threads; i++)
+    workers.push_back(std::thread(&ThreadPool::work, this));
+}
+
+ThreadPool::~ThreadPool ()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+}
+
+int32_t
+ThreadPool::hardwareThreads ()
+{
+  int32_t n = (int32_t) std::thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+void
+ThreadPool::work ()
+{
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      wake.wait(guard, [this] { return stopping || !tasks.empty(); });
+      if (tasks.empty())
+        return;
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    task();
+  }
+}
+
+namespace {
+// Bands of one parallelFor() call. Tasks that start late may still hold
+// it after the caller returned, hence shared ownership.
+struct Job
+{
+  std::function<void(int32_t, int32_t)> body;
+  int32_t                               count, bands;
+  std::atomic<int32_t>                  next, done;
+  std::mutex                            lock;
+  std::condition_variable               finished;
+
+  // Run bands until none is left.
+  void run() {
+    int32_t b;
+    while ((b = next.fetch_add(1)) < bands) {
+      body((int64_t) count * b / bands, (int64_t) count * (b + 1) / bands);
+      if (done.fetch_add(1) + 1 == bands) {
+        std::lock_guard<std::mutex> guard(lock);
+        finished.notify_all();
+      }
+    }
+  }
+};
+}
+
+void
+ThreadPool::parallelFor (int32_t count,
+                         const std::function<void(int32_t, int32_t)>& body,
+                         int32_t grain)
+{
+  if (count <= 0)
+    return;
+  if (grain < 1)
+    grain = 1;
+
+  int32_t bands = (count + grain - 1) / grain;
+  if (bands > getThreads() * BANDS_PER_THREAD)
+    bands = getThreads() * BANDS_PER_THREAD;
+  if (bands <= 1 || workers.empty()) {
+    body(0, count);
+    return;
+  }
+
+  std::shared_ptr<Job> job = std::make_shared<Job>();
+  job->body  = body;
+  job->count = count;
+  job->bands = bands;
+  job->next  = 0;
+  job->done  = 0;
+
+  int32_t helpers = bands - 1 < (int32_t) workers.size() ?
+                    bands - 1 : (int32_t) workers.size();
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    for (int32_t i = 0; i < helpers; i++)
+      tasks.push_back([job] { job->run(); });
+  }
+  if (helpers == 1)
+    wake.notify_one();
+  else
+    wake.notify_all();
+
+  job->run();
+
+  std::unique_lock<std::mutex> guard(job->lock);
+  job->finished.wait(guard, [&job] { return job->done == job->bands; });
+}
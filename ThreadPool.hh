@@ -0,0 +1,49 @@
+#ifndef __THREADPOOL_HH__
+#define __THREADPOOL_HH__
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads for splitting loops into bands. The
+// calling thread works on the bands too, so parallelFor() also completes
+// when called from inside a worker or while all workers are busy.
+class ThreadPool
+{
+public:
+  // threads counts the caller, threads - 1 workers are started; 0 for
+  // one per hardware thread.
+  ThreadPool(int32_t threads);
+  ~ThreadPool();
+
+  int32_t getThreads() const { return (int32_t) workers.size() + 1; };
+
+  // Call body(begin, end) for bands of consecutive indices that together
+  // cover 0 <= i < count, returning when all are done. Bands hold at
+  // least grain indices; they may run in any order and concurrently.
+  void parallelFor(int32_t count,
+                   const std::function<void(int32_t, int32_t)>& body,
+                   int32_t grain = 1);
+
+  // Hardware threads of the machine, at least 1.
+  static int32_t hardwareThreads();
+
+private:
+  ThreadPool(const ThreadPool&);
+  ThreadPool& operator=(const ThreadPool&);
+
+  void work();
+
+  std::vector<std::thread>          workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex                        lock;
+  std::condition_variable           wake;
+  bool                              stopping;
+};
+
+#endif // __THREADPOOL_HH__
@@ -0,0 +1,148 @@
+#include <errno.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#  include <direct.h>
+#endif
+
+#include <atomic>
+#include <string>
+#include <utility>
+
+#include "PNGImage.hh"
+#include "ResampleStats.hh"
+#include "Resampler.hh"
+#include "ThreadPool.hh"
+#include "TilePyramid.hh"
+
+// Create a directory unless it exists.
+static int
+makeDirectory (const std::string& path)
+{
+#ifdef _WIN32
+  int status = _mkdir(path.c_str());
+#else
+  int status = mkdir(path.c_str(), 0777);
+#endif
+  return status == 0 || errno == EEXIST ? 0 : -1;
+}
+
+TilePyramid::TilePyramid (const Resampler& resampler,
+                          int32_t tileSize, int32_t overlap) :
+  resampler(resampler)
+{
+  this->tileSize = tileSize > 0 ? tileSize : 1;
+  this->overlap  = overlap  > 0 ? overlap  : 0;
+  profile = png_profile_balanced;
+}
+
+int32_t
+TilePyramid::getTopLevel (int32_t width, int32_t height)
+{
+  int32_t size  = width > height ? width : height;
+  int32_t level = 0;
+
+  while (size > 1) {
+    size = (size + 1) / 2;
+    level++;
+  }
+  return level;
+}
+
+int
+TilePyramid::write (const Image& src, const std::string& name,
+                    const PNGInfo& info) const
+{
+  std::string base = name;
+  if (base.size() > 4 && base.compare(base.size() - 4, 4, ".dzi") == 0)
+    base.erase(base.size() - 4);
+  std::string files = base + "_files";
+
+  if (makeDirectory(files) != 0 ||
+      writeDescriptor(base + ".dzi", src.getWidth(), src.getHeight()) != 0)
+    return -1;
+
+  // Only the current level and the one made from it are kept.
+  const Image *level = &src;
+  Image        next(0, 0, src.getNComps(), src.getBPC());
+  for (int32_t n = getTopLevel(src.getWidth(), src.getHeight()); ; n--) {
+    std::string dir = files + "/" + std::to_string(n);
+    int status;
+    {
+      StageTimer timer(resampler.getStats(), stage_encode);
+      status = makeDirectory(dir) == 0 ? writeLevel(*level, dir, info) : -1;
+    }
+    if (status != 0)
+      return -1;
+    if (n == 0)
+      break;
+    next  = resampler.resampleImage(*level, (level->getWidth()  + 1) / 2,
+                                            (level->getHeight() + 1) / 2);
+    level = &next;
+  }
+
+  return 0;
+}
+
+// Tile (i, j) covers columns i * tileSize - overlap to
+// (i + 1) * tileSize + overlap, clipped to the level, and likewise rows.
+int
+TilePyramid::writeLevel (const Image& level, const std::string& dir,
+                         const PNGInfo& info) const
+{
+  int32_t columns = (level.getWidth()  + tileSize - 1) / tileSize;
+  int32_t rows    = (level.getHeight() + tileSize - 1) / tileSize;
+  std::atomic<int> error(0);
+
+  auto body = [&](int32_t begin, int32_t end) {
+    for (int32_t t = begin; t < end; t++) {
+      int32_t i  = t % columns, j = t / columns;
+      int32_t x0 = i * tileSize - (i > 0 ? overlap : 0);
+      int32_t y0 = j * tileSize - (j > 0 ? overlap : 0);
+      int32_t x1 = (i + 1) * tileSize + overlap;
+      int32_t y1 = (j + 1) * tileSize + overlap;
+      if (x1 > level.getWidth())
+        x1 = level.getWidth();
+      if (y1 > level.getHeight())
+        y1 = level.getHeight();
+
+      Image tile = level.getRegion(x0, y0, x1 - x0, y1 - y0);
+      std::string file =
+          dir + "/" + std::to_string(i) + "_" + std::to_string(j) + ".png";
+      if (PNGImage::save(file, tile, info, NULL, profile) != 0)
+        error = -1;
+      else if (resampler.getStats()) {
+        struct stat st;
+        if (stat(file.c_str(), &st) == 0)
+          resampler.getStats()->addBytesWritten(st.st_size);
+      }
+    }
+  };
+  ThreadPool *pool = resampler.getThreadPool();
+  if (pool)
+    pool->parallelFor(columns * rows, body);
+  else
+    body(0, columns * rows);
+
+  return error;
+}
+
+int
+TilePyramid::writeDescriptor (const std::string& file,
+                              int32_t width, int32_t height) const
+{
+  FILE *fp = fopen(file.c_str(), "w");
+  if (!fp)
+    return -1;
+
+  fprintf(fp,
+          "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+          "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\"\n"
+          "       Format=\"png\" Overlap=\"%d\" TileSize=\"%d\">\n"
+          "  <Size Width=\"%d\" Height=\"%d\"/>\n"
+          "</Image>\n",
+          (int) overlap, (int) tileSize, (int) width, (int) height);
+
+  return fclose(fp) == 0 ? 0 : -1;
+}
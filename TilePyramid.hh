@@ -0,0 +1,57 @@
+#ifndef __TILEPYRAMID_HH__
+#define __TILEPYRAMID_HH__
+
+#include <stdint.h>
+
+#include <string>
+
+#include "Image.hh"
+#include "PNGImage.hh"
+
+class Resampler;
+
+// Deep Zoom image pyramid. Level n is the source scaled by 2^(n - top),
+// sizes rounded up, from 1 by 1 pixel at level 0 to the source at the top
+// level. Each level is cut into tileSize square tiles, extended by overlap
+// pixels into each neighbour, and written as
+//   name.dzi
+//   name_files/<level>/<column>_<row>.png
+// Levels are resampled from the one above with the resampler's filter, so
+// all of them together cost about a third more than one pass over the
+// source, and no more than two levels are held at a time. Tiles of a level
+// are written on the resampler's thread pool.
+class TilePyramid
+{
+public:
+  TilePyramid(const Resampler& resampler,
+              int32_t tileSize = 254, int32_t overlap = 1);
+
+  int32_t getTileSize() const { return tileSize; };
+  int32_t getOverlap()  const { return overlap; };
+
+  // Encoder profile of the tiles, balanced by default.
+  void setProfile(enum png_profile_e profile) { this->profile = profile; };
+  enum png_profile_e getProfile() const { return profile; };
+
+  // Write the pyramid of src, which must be 8 or 16 bpc. A ".dzi" suffix
+  // of name is dropped. Returns 0 on success, -1 if a file or directory
+  // could not be written.
+  int write(const Image& src, const std::string& name,
+            const PNGInfo& info) const;
+
+  // Index of the top level for an image of the given size.
+  static int32_t getTopLevel(int32_t width, int32_t height);
+
+private:
+  int writeLevel(const Image& level, const std::string& dir,
+                 const PNGInfo& info) const;
+  int writeDescriptor(const std::string& file,
+                      int32_t width, int32_t height) const;
+
+  const Resampler& resampler;
+  int32_t          tileSize;
+  int32_t          overlap;
+  enum png_profile_e profile;
+};
+
+#endif // __TILEPYRAMID_HH__
@@ -0,0 +1,370 @@
+// Benchmark of the resampler and the PNG codec on synthetic images.
+//
+// Every filter is timed for an upscale and a downscale of 1 to 4 channel,
+// 8 and 16 bpc images, in stages: contributor setup (building a plan),
+// the horizontal pass and the vertical pass. PNG decode, and encode with
+// each encoder profile, are timed once per channel count and depth; the
+// encode results also give the size of the file. Each stage runs once to warm
+// up, then -n times; the mean, standard deviation and throughput are
+// written one result per line to a JSON file, which a later run can be
+// compared against with -c.
+//
+// Throughput counts the pixels of the larger of the source and the
+// destination image of the resample, or of the image decoded or encoded.
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "PNGImage.hh"
+#include "ResampleKernels.hh"
+#include "ResamplePlan.hh"
+#include "Resampler.hh"
+#include "ThreadPool.hh"
+
+// Source sizes of the downscale and the upscale, both to and from
+// BENCH_WIDTH by BENCH_HEIGHT, by the factors below.
+#define BENCH_WIDTH  1024
+#define BENCH_HEIGHT 768
+#define BENCH_DOWN   3
+#define BENCH_UP     2
+
+static const char u[] = "\
+usage: resample-bench [-options]\n\
+options:\n\
+    -o file     write results to file (default bench.json)\n\
+    -c file     compare with the results of an earlier run\n\
+    -p percent  slowdown reported as a regression with -c (default 10)\n\
+    -n runs     timed runs of each stage (default 5)\n\
+    -j threads  number of threads, 0 for all cores (default 1)\n\
+";
+
+void
+usage()
+{
+  fprintf(stderr, "%s\n", u);
+  exit(1);
+}
+
+static const char *const channels[] = { "gray", "ga", "rgb", "rgba" };
+
+struct BenchResult
+{
+  std::string name;
+  double      meanMs, stddevMs;
+  double      mpix;   // megapixels per run
+  uint64_t    bytes;  // size of the output, 0 when there is none
+};
+
+// Fill an image with smooth gradients and a little noise, so that PNG
+// compresses it about as well as a photograph.
+static void
+fillImage (Image& image)
+{
+  uint32_t seed = 12345;
+  int32_t  width = image.getWidth(), nComps = image.getNComps();
+  float    max = image.getBPC() == 8 ? 255.0f : 65535.0f;
+
+  for (int32_t y = 0; y < image.getHeight(); y++) {
+    for (int32_t x = 0; x < width; x++) {
+      for (int32_t c = 0; c < nComps; c++) {
+        seed = seed * 1103515245 + 12345;
+        float v = 0.5f + 0.4f * sinf((x * (c + 1) + y * (3 - c)) * 0.01f) +
+                  ((seed >> 16) & 0xff) / 255.0f * 0.05f;
+        int32_t k = x * nComps + c;
+        if (image.getBPC() == 8)
+          image.getRowAs<uint8_t>(y)[k]  = (uint8_t)  (v * max);
+        else
+          image.getRowAs<uint16_t>(y)[k] = (uint16_t) (v * max);
+      }
+    }
+  }
+}
+
+// Times the stages of the resampler one at a time, which needs its private
+// passes.
+class ResampleBench
+{
+public:
+  ResampleBench(int runs, ThreadPool *pool) : runs(runs), pool(pool) {};
+
+  void run();
+  const std::vector<BenchResult>& getResults() const { return results; };
+
+private:
+  int          runs;
+  ThreadPool  *pool;
+  std::vector<BenchResult> results;
+
+  void measure(const std::string& name, double mpix,
+               const std::function<void()>& body, uint64_t bytes = 0);
+  void resampleCase(const struct filterItem& filter, const char *scale,
+                    const Image& src, int32_t width, int32_t height);
+  void codecCase(const Image& image, const std::string& label);
+};
+
+void
+ResampleBench::measure (const std::string& name, double mpix,
+                        const std::function<void()>& body, uint64_t bytes)
+{
+  std::vector<double> ms;
+
+  body();
+  for (int i = 0; i < runs; i++) {
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    body();
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    ms.push_back(elapsed.count());
+  }
+
+  double sum = 0, sq = 0;
+  for (size_t i = 0; i < ms.size(); i++)
+    sum += ms[i];
+  double mean = sum / ms.size();
+  for (size_t i = 0; i < ms.size(); i++)
+    sq += (ms[i] - mean) * (ms[i] - mean);
+  BenchResult result = { name, mean,
+                         ms.size() > 1 ? sqrt(sq / (ms.size() - 1)) : 0,
+                         mpix, bytes };
+  results.push_back(result);
+  fprintf(stderr, "%-32s %9.3f ms +- %7.3f %9.2f Mpix/s",
+          name.c_str(), mean, result.stddevMs, mpix / mean * 1000.0);
+  if (bytes > 0)
+    fprintf(stderr, " %10llu bytes", (unsigned long long) bytes);
+  fprintf(stderr, "\n");
+}
+
+void
+ResampleBench::resampleCase (const struct filterItem& filter,
+                             const char *scale, const Image& src,
+                             int32_t width, int32_t height)
+{
+  std::string name = std::string(filter.name) + "/" + scale + "/" +
+                     channels[src.getNComps() - 1] +
+                     std::to_string(src.getBPC()) + "/";
+  double larger = src.getWidth() * src.getHeight() > width * height ?
+                  src.getWidth() * src.getHeight() : width * height;
+  double mpix = larger / 1e6;
+
+  Resampler resampler(filter.name);
+  resampler.setThreadPool(pool);
+  // Plans built here, outside the cache, and without box pre-reduction,
+  // so that the passes see the whole source.
+  measure(name + "setup", mpix, [&]() {
+    ResamplePlan plan(filter, src.getWidth(), src.getHeight(),
+                      width, height, false);
+  });
+
+  ResamplePlan plan(filter, src.getWidth(), src.getHeight(),
+                    width, height, false);
+  Image tmp = resampler.horizontalPass(src, width, plan.getContributorX());
+  Image dst(width, height, src.getNComps(), src.getBPC());
+  measure(name + "x", mpix, [&]() {
+    tmp = resampler.horizontalPass(src, width, plan.getContributorX());
+  });
+  measure(name + "y", mpix, [&]() {
+    resampler.verticalPass(dst, tmp, plan.getContributorY());
+  });
+  // Both passes the other way round, in float, as the plan may order them.
+  Image tmpY(src.getWidth(), height, src.getNComps(), 32);
+  measure(name + "yx", mpix, [&]() {
+    resampler.resampleYSource(tmpY, src, plan.getContributorY(), false);
+    resampler.resampleX(dst, tmpY, plan.getContributorX(), true, true);
+  });
+}
+
+void
+ResampleBench::codecCase (const Image& image, const std::string& label)
+{
+  const char *tmpdir = getenv("TMPDIR");
+  std::string file = std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") +
+                     "/resample-bench-" + std::to_string(getpid()) + ".png";
+  double mpix = image.getWidth() * image.getHeight() / 1e6;
+  PNGInfo info;
+
+  for (int p = 0; p < NUM_PNG_PROFILES; p++) {
+    png_profile_e profile = (png_profile_e) p;
+    std::function<void()> encode = [&]() {
+      if (PNGImage::save(file, image, info, pool, profile) != 0)
+        fprintf(stderr, "Could not save %s\n", file.c_str());
+    };
+    struct stat st;
+    encode();
+    measure("png/" + label + "/encode-" + PNGImage::getProfileName(profile),
+            mpix, encode, stat(file.c_str(), &st) == 0 ? st.st_size : 0);
+  }
+  measure("png/" + label + "/decode", mpix, [&]() {
+    PNGImage decoded(file);
+    if (!decoded.valid())
+      fprintf(stderr, "Could not load %s\n", file.c_str());
+  });
+  unlink(file.c_str());
+}
+
+void
+ResampleBench::run ()
+{
+  for (int8_t bpc = 8; bpc <= 16; bpc += 8) {
+    for (int8_t nComps = 1; nComps <= 4; nComps++) {
+      Image large(BENCH_WIDTH, BENCH_HEIGHT, nComps, bpc);
+      Image small(BENCH_WIDTH / BENCH_UP, BENCH_HEIGHT / BENCH_UP,
+                  nComps, bpc);
+      fillImage(large);
+      fillImage(small);
+
+      for (int f = 0; f < Resampler::NUM_FILTERS; f++) {
+        const struct filterItem& filter = Resampler::filters[f];
+        resampleCase(filter, "down", large, BENCH_WIDTH / BENCH_DOWN,
+                     BENCH_HEIGHT / BENCH_DOWN);
+        resampleCase(filter, "up", small, BENCH_WIDTH, BENCH_HEIGHT);
+      }
+      codecCase(large, channels[nComps - 1] + std::to_string(bpc));
+    }
+  }
+}
+
+static int
+writeResults (const std::string& file, const std::vector<BenchResult>& results,
+              int runs, int threads)
+{
+  FILE *fp = fopen(file.c_str(), "w");
+  if (!fp)
+    return -1;
+
+  fprintf(fp, "{\n  \"isa\": \"%s\",\n  \"runs\": %d,\n  \"threads\": %d,\n"
+          "  \"results\": [\n", getResampleKernels()->name, runs, threads);
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult& r = results[i];
+    double rate = r.mpix / r.meanMs * 1000.0;
+    // First order propagation of the deviation of the time.
+    fprintf(fp, "    {\"name\": \"%s\", \"mean_ms\": %.4f, \"stddev_ms\": %.4f, "
+            "\"mpix_per_s\": %.3f, \"mpix_per_s_stddev\": %.3f",
+            r.name.c_str(), r.meanMs, r.stddevMs, rate,
+            rate * r.stddevMs / r.meanMs);
+    if (r.bytes > 0)
+      fprintf(fp, ", \"bytes\": %llu", (unsigned long long) r.bytes);
+    fprintf(fp, "}%s\n", i + 1 < results.size() ? "," : "");
+  }
+  fprintf(fp, "  ]\n}\n");
+
+  return fclose(fp) == 0 ? 0 : -1;
+}
+
+// Read back the times of a file written above, by name.
+static int
+readResults (const std::string& file,
+             std::map<std::string, BenchResult>& results)
+{
+  FILE *fp = fopen(file.c_str(), "r");
+  if (!fp)
+    return -1;
+
+  char   line[512], name[256];
+  double mean, stddev;
+  while (fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, " {\"name\": \"%255[^\"]\", \"mean_ms\": %lf, "
+               "\"stddev_ms\": %lf", name, &mean, &stddev) == 3) {
+      BenchResult result = { name, mean, stddev, 0, 0 };
+      results[name] = result;
+    }
+  }
+  fclose(fp);
+  return 0;
+}
+
+// Print the stages slower than the baseline by more than percent, and
+// return how many. Differences within twice the combined standard
+// deviation of both runs are taken as noise.
+static int
+compareResults (const std::vector<BenchResult>& results,
+                const std::map<std::string, BenchResult>& baseline,
+                double percent)
+{
+  int    slower = 0, compared = 0;
+  double logSum = 0;
+
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult& now = results[i];
+    std::map<std::string, BenchResult>::const_iterator old =
+        baseline.find(now.name);
+    if (old == baseline.end() || old->second.meanMs <= 0)
+      continue;
+    const BenchResult& then = old->second;
+    double ratio = now.meanMs / then.meanMs;
+    double noise = 2.0 * sqrt(now.stddevMs * now.stddevMs +
+                              then.stddevMs * then.stddevMs);
+    logSum += log(ratio);
+    compared++;
+    if (ratio > 1.0 + percent / 100.0 && now.meanMs - then.meanMs > noise) {
+      printf("slower %-32s %9.3f ms, was %9.3f ms (%+.1f%%)\n",
+             now.name.c_str(), now.meanMs, then.meanMs,
+             (ratio - 1.0) * 100.0);
+      slower++;
+    }
+  }
+  if (compared > 0)
+    printf("%d of %d stages slower by more than %g%%, "
+           "geometric mean time ratio %.3f\n",
+           slower, compared, percent, exp(logSum / compared));
+  else
+    printf("no stages in common with the baseline\n");
+  return slower;
+}
+
+int
+main (int argc, char *argv[])
+{
+  extern int   optind;
+  extern char *optarg;
+  std::string  output = "bench.json";
+  std::string  baseline;
+  double       percent = 10;
+  int          runs = 5;
+  int          threads = 1;
+
+  int c;
+  while ((c = getopt(argc, argv, "o:c:p:n:j:")) != EOF) {
+    switch (c) {
+    case 'o': output   = optarg;       break;
+    case 'c': baseline = optarg;       break;
+    case 'p': percent  = atof(optarg); break;
+    case 'n': runs     = atoi(optarg); break;
+    case 'j': threads  = atoi(optarg); break;
+    default:  usage();
+    }
+  }
+  if (optind != argc || runs < 1)
+    usage();
+
+  // Read the baseline first, it may be the file about to be written.
+  std::map<std::string, BenchResult> old;
+  if (!baseline.empty() && readResults(baseline, old) != 0) {
+    fprintf(stderr, "Could not read %s\n", baseline.c_str());
+    exit(2);
+  }
+
+  ThreadPool    pool(threads);
+  ResampleBench bench(runs, threads == 1 ? NULL : &pool);
+  bench.run();
+
+  if (writeResults(output, bench.getResults(), runs,
+                   pool.getThreads()) != 0) {
+    fprintf(stderr, "Could not write %s\n", output.c_str());
+    exit(2);
+  }
+  if (!baseline.empty() &&
+      compareResults(bench.getResults(), old, percent) > 0)
+    return 1;
+
+  return 0;
+}
@@ -1,31 +1,89 @@
 // A sample program for resampling PNG image.
+// PNM, PAM and raw files (see MappedImage.hh) are read and written too,
+// as the file names call for. With -B, many files go through decode,
+// resample and encode as a pipeline, each stage on its own thread. With
+// -D, it stays running and takes jobs from a socket or stdin.
 
 #include <unistd.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
+#include <atomic>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "BoundedQueue.hh"
+#include "ImageAllocator.hh"
+#include "LinearLight.hh"
+#include "MappedImage.hh"
 #include "PNGImage.hh"
+#include "ResampleKernels.hh"
+#include "ResampleServer.hh"
+#include "ResampleStats.hh"
 #include "Resampler.hh"
+#include "ThreadPool.hh"
+#include "TilePyramid.hh"
 
 static const char u[] = "\
-usage: resample [-options] input.png output.png\n\
+usage: resample [-options] input.png [output.png]\n\
+       (or .ppm, .pgm, .pnm, .pam or .raw for either file)\n\
+       resample -z tilesize [-options] input.png name\n\
+       resample -B outdir [-options] input.png...\n\
+       resample -D socket|- [-options]\n\
 options:\n\
     -a          keep aspect ratio\n\
     -r          set resolution (dpi)\n\
     -x xsize    width of output image (in pixels)\n\
     -y ysize    height of output image\n\
+    -t WxH=file another output image of W by H pixels, may be repeated;\n\
+                W or H may be left out as with -x and -y\n\
     -f filter   filter type\n\
+    -F          floating point arithmetic for 8 bpc images too (default:\n\
+                fixed point)\n\
+    -e          box pre-reduction ahead of the filter for reductions from\n\
+                6 times: faster, but noise and sharp edges come out up to\n\
+                28/255 off the filter alone; not in linear light\n\
+    -E          no box pre-reduction (default)\n\
+    -l          filter in linear light, decoding with the gAMA of the\n\
+                source or else sRGB, and encoding the output alike\n\
+    -j threads  number of threads, 0 for all cores (default 1)\n\
+    -s          stream rows through the resampler, for images too large\n\
+                to be held in memory\n\
+    -m megabytes\n\
+                resample out of core in about this much memory, with a\n\
+                scratch file in $TMPDIR for what does not fit\n\
+    -z tilesize write a Deep Zoom pyramid of tiles, name.dzi and name_files/\n\
+    -o overlap  pixels of overlap between pyramid tiles (default 1)\n\
+    -B outdir   resample every input to a file of the same name in outdir;\n\
+                while one is encoded the next is resampled and the one\n\
+                after decoded\n\
+    -q depth    images waiting between two stages of -B (default 2); at\n\
+                most 2 * depth + 3 are in memory at once\n\
+    -D socket   serve jobs, lines of [options] input output, from the\n\
+                clients of a Unix socket made at socket, or from stdin with\n\
+                -; see ResampleServer.hh\n\
+    -w workers  jobs run at once by -D (default 2); -q jobs wait\n\
+    -P profile  PNG encoder effort: fastest, balanced (default) or\n\
+                smallest\n\
+    -S file     write wall and CPU time of each stage, plans, peak memory\n\
+                and bytes read and written as JSON to file, - for stdout\n\
 Available filters are:\n\
      b          Box\n\
      l          Biliner\n\
      B          B-spline\n\
      c          Bicubic\n\
-     L          Lanczos\n\
+     L          Lanczos (3 lobes)\n\
      m          Mitchell\n\
+     2          Lanczos2 (2 lobes)\n\
+     4          Lanczos4 (4 lobes)\n\
+     g          Gaussian (sigma 0.5)\n\
 ";
 
 void
@@ -35,6 +93,465 @@ usage()
   exit(1);
 }
 
+// An output image: requested size, 0 where not given, and file name.
+struct Target
+{
+  int32_t     xsize, ysize;
+  std::string file;
+};
+
+// Parse "WxH=file"; W and H may be empty.
+static bool
+parseTarget (const char *arg, Target& target)
+{
+  const char *x  = strchr(arg, 'x');
+  const char *eq = strchr(arg, '=');
+
+  if (!x || !eq || x > eq || eq[1] == '\0')
+    return false;
+  target.xsize = atoi(arg);
+  target.ysize = atoi(x + 1);
+  target.file  = eq + 1;
+  return true;
+}
+
+// Sizes not given are those of the source, or follow from the other one
+// with keep_aspect.
+static void
+completeSize (Target& target, bool keep_aspect, int32_t width, int32_t height)
+{
+  int32_t& xsize = target.xsize;
+  int32_t& ysize = target.ysize;
+
+  if (xsize > 0 && ysize > 0) {
+    if (keep_aspect)
+      std::cerr << "Ignoring -a option." << std::endl;
+  } else if (keep_aspect) {
+    if (xsize == 0)
+      xsize = ysize * width  / height;
+    if (ysize == 0)
+      ysize = xsize * height / width;
+  }
+  if (xsize <= 0)
+    xsize = width;
+  if (ysize <= 0)
+    ysize = height;
+}
+
+// Writer for the format the file name calls for, NULL if it can not be
+// created.
+static RowSink *
+createWriter (const Target& target, int8_t nComps, int8_t bpc,
+              const PNGInfo& info, ThreadPool *pool,
+              enum png_profile_e profile)
+{
+  int format = MappedImage::formatOf(target.file);
+
+  if (format >= 0) {
+    MappedWriter *writer =
+        new MappedWriter(target.file, target.xsize, target.ysize,
+                         nComps, bpc, (enum mapped_format_e) format);
+    if (writer->valid())
+      return writer;
+    delete writer;
+  } else {
+    PNGWriter *writer = new PNGWriter(target.file, target.xsize, target.ysize,
+                                      nComps, bpc, info, pool, profile);
+    if (writer->valid())
+      return writer;
+    delete writer;
+  }
+  return NULL;
+}
+
+// Transfer curve of a source for -l: its gAMA, or sRGB if it has none.
+// An ICC profile is taken for sRGB too, the usual case.
+static std::shared_ptr<const LinearLight>
+linearLightOf (const PNGInfo& info)
+{
+  switch (info.getColorSpaceType()) {
+  case png_colorspace_gamma_only:
+  case png_colorspace_calibrated:
+    if (info.getGamma() > 0)
+      return LinearLight::get(info.getGamma());
+    break;
+  default:
+    break;
+  }
+  return LinearLight::get(0);
+}
+
+static int
+saveImage (const std::string& file, const Image& image, const PNGInfo& info,
+           ThreadPool *pool, enum png_profile_e profile)
+{
+  int format = MappedImage::formatOf(file);
+
+  if (format >= 0)
+    return MappedImage::save(file, image, (enum mapped_format_e) format);
+  return PNGImage::save(file, image, info, pool, profile);
+}
+
+// Size of a file, 0 if it can not be found.
+static uint64_t
+fileSize (const std::string& file)
+{
+  struct stat st;
+  return stat(file.c_str(), &st) == 0 ? (uint64_t) st.st_size : 0;
+}
+
+// Whether two names are of the same existing file.
+static bool
+sameFile (const std::string& a, const std::string& b)
+{
+  struct stat sa, sb;
+  return stat(a.c_str(), &sa) == 0 && stat(b.c_str(), &sb) == 0 &&
+         sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+// A string as a JSON string literal.
+static std::string
+quote (const std::string& s)
+{
+  std::string q = "\"";
+  for (size_t i = 0; i < s.size(); i++) {
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\') {
+      q += '\\';
+      q += c;
+    } else if (c < 0x20) {
+      char code[8];
+      snprintf(code, sizeof(code), "\\u%04x", c);
+      q += code;
+    } else
+      q += c;
+  }
+  return q + "\"";
+}
+
+// The record of -S: the job, its totals, the buffer pool if there is one
+// and the stages of stats. A batch has a list of inputs where a single job
+// has one.
+static int
+writeRecord (const std::string& file, const std::vector<std::string>& inputs,
+             const std::vector<std::string>& outputs, int status, int threads,
+             int64_t wall, int64_t cpu, const BufferPool *buffers,
+             const ResampleStats& stats)
+{
+  FILE *fp = file == "-" ? stdout : fopen(file.c_str(), "w");
+  if (!fp)
+    return -1;
+
+  if (inputs.size() == 1)
+    fprintf(fp, "{\n  \"input\": %s,\n", quote(inputs[0]).c_str());
+  else {
+    fprintf(fp, "{\n  \"inputs\": [");
+    for (size_t i = 0; i < inputs.size(); i++)
+      fprintf(fp, "%s%s", i > 0 ? ", " : "", quote(inputs[i]).c_str());
+    fprintf(fp, "],\n");
+  }
+  fprintf(fp, "  \"outputs\": [");
+  for (size_t t = 0; t < outputs.size(); t++)
+    fprintf(fp, "%s%s", t > 0 ? ", " : "", quote(outputs[t]).c_str());
+  fprintf(fp, "],\n  \"status\": %d,\n  \"threads\": %d,\n"
+          "  \"isa\": \"%s\",\n  \"wall_ms\": %.3f,\n  \"cpu_ms\": %.3f,\n",
+          status, threads, getResampleKernels()->name, wall / 1e6, cpu / 1e6);
+  if (buffers)
+    fprintf(fp, "  \"buffer_pool\": %s,\n", buffers->getStatus().c_str());
+  stats.writeJSON(fp, "  ");
+  fprintf(fp, "}\n");
+
+  if (fp == stdout)
+    return fflush(fp) == 0 ? 0 : -1;
+  return fclose(fp) == 0 ? 0 : -1;
+}
+
+// Filter of a -f letter, empty if there is none.
+static std::string
+filterName (char letter)
+{
+  switch (letter) {
+  case 'b': return "Box";
+  case 'l': return "Bilinear";
+  case 'B': return "B-spline";
+  case 'c': return "Bicubic";
+  case 'L': return "Lanczos";
+  case 'm': return "Mitchell";
+  case '2': return "Lanczos2";
+  case '4': return "Lanczos4";
+  case 'g': return "Gaussian";
+  default:  return "";
+  }
+}
+
+// What the command line of the server sets for all of its jobs; a job may
+// change the filter, profile and resolution, turn off fixed point, turn
+// box pre-reduction on or off, or turn on linear light.
+struct ServerDefaults
+{
+  std::string        filter;
+  bool               fixed_point, shrink, linear;
+  int32_t            dpi;
+  enum png_profile_e profile;
+  ThreadPool        *pool;
+};
+
+// Run a request of the server: blank separated words
+//   [-x xsize] [-y ysize] [-a] [-r dpi] [-f filter] [-F] [-e] [-E] [-l]
+//   [-P profile] input output
+// the options as on the command line. The files are read and written
+// whole. Returns 0, or -1 with a message in error.
+static int
+runServerJob (const std::string& request, const ServerDefaults& defaults,
+              std::string& error)
+{
+  std::vector<std::string> words;
+  std::string::size_type   begin, end = 0;
+  while ((begin = request.find_first_not_of(" \t", end)) !=
+         std::string::npos) {
+    end = request.find_first_of(" \t", begin);
+    words.push_back(request.substr(begin, end - begin));
+  }
+
+  ServerDefaults settings = defaults;
+  Target         target = { 0, 0, "" };
+  bool           keep_aspect = false;
+  size_t         w = 0;
+  for (; w < words.size() && words[w].size() == 2 && words[w][0] == '-';
+       w++) {
+    char option = words[w][1];
+    if (option == 'a' || option == 'F' || option == 'e' || option == 'E' ||
+        option == 'l') {
+      keep_aspect = keep_aspect || option == 'a';
+      settings.fixed_point = settings.fixed_point && option != 'F';
+      settings.shrink      = (settings.shrink || option == 'e') &&
+                             option != 'E';
+      settings.linear      = settings.linear || option == 'l';
+      continue;
+    }
+    if (w + 1 >= words.size()) {
+      error = "missing value of " + words[w];
+      return -1;
+    }
+    const std::string& value = words[++w];
+    switch (option) {
+    case 'x': target.xsize = atoi(value.c_str()); break;
+    case 'y': target.ysize = atoi(value.c_str()); break;
+    case 'r': settings.dpi = atoi(value.c_str()); break;
+    case 'f':
+      settings.filter = filterName(value[0]);
+      if (settings.filter.empty()) {
+        error = "unknown filter " + value;
+        return -1;
+      }
+      break;
+    case 'P':
+      if (PNGImage::profileOf(value) < 0) {
+        error = "unknown profile " + value;
+        return -1;
+      }
+      settings.profile = (enum png_profile_e) PNGImage::profileOf(value);
+      break;
+    default:
+      error = "unknown option " + words[w - 1];
+      return -1;
+    }
+  }
+  if (words.size() - w != 2) {
+    error = "expected input and output";
+    return -1;
+  }
+  const std::string& srcfile = words[w];
+  target.file = words[w + 1];
+
+  std::unique_ptr<PNGImage>    png;
+  std::unique_ptr<MappedImage> mapped;
+  const Image *src;
+  PNGInfo      info;
+  if (MappedImage::formatOf(srcfile) >= 0) {
+    mapped.reset(new MappedImage(srcfile));
+    src = mapped->valid() ? mapped.get() : NULL;
+  } else {
+    png.reset(new PNGImage(srcfile));
+    src = png->valid() ? png.get() : NULL;
+    info.setInfo(*png);
+  }
+  if (!src) {
+    error = "loading " + srcfile + " failed";
+    return -1;
+  }
+  if (settings.dpi > 0)
+    info.setResolution(settings.dpi, settings.dpi);
+  completeSize(target, keep_aspect, src->getWidth(), src->getHeight());
+
+  Resampler resampler(settings.filter);
+  resampler.setThreadPool(settings.pool);
+  resampler.setFixedPoint(settings.fixed_point);
+  resampler.setShrinkOnLoad(settings.shrink);
+  if (settings.linear)
+    resampler.setLinearLight(linearLightOf(info));
+  std::vector<ResampleSize> sizes(1);
+  sizes[0].width  = target.xsize;
+  sizes[0].height = target.ysize;
+  std::vector<Image> dst = resampler.resampleImages(*src, sizes);
+  png.reset();
+  mapped.reset();
+
+  if (saveImage(target.file, dst[0], info, settings.pool,
+                settings.profile) != 0) {
+    error = "saving " + target.file + " failed";
+    return -1;
+  }
+  return 0;
+}
+
+// A file on its way through the batch pipeline.
+struct BatchItem
+{
+  Target                       target;
+  std::unique_ptr<PNGImage>    png;
+  std::unique_ptr<MappedImage> mapped;
+  std::vector<Image>           dst;
+  PNGInfo                      info;
+};
+
+typedef BoundedQueue<std::unique_ptr<BatchItem> > BatchQueue;
+
+// Settings of a batch shared by its stages, and its exit status.
+struct Batch
+{
+  std::string         outdir;
+  int32_t             xsize, ysize, dpi;
+  bool                keep_aspect;
+  bool                linear;
+  enum png_profile_e  profile;
+  Resampler          *resampler;
+  ThreadPool         *pool;
+  ResampleStats      *record;
+  std::atomic<int>    status;
+};
+
+// First stage: read each input whole. Failures, and inputs that would be
+// overwritten, are reported and dropped.
+static void
+decodeBatch (Batch& batch, const std::vector<std::string>& inputs,
+             BatchQueue& decoded)
+{
+  for (size_t i = 0; i < inputs.size(); i++) {
+    std::unique_ptr<BatchItem> item(new BatchItem);
+    const Image *src;
+    bool         loaded;
+
+    std::string::size_type slash = inputs[i].rfind('/');
+    item->target.xsize = batch.xsize;
+    item->target.ysize = batch.ysize;
+    item->target.file  = batch.outdir + "/" +
+        (slash == std::string::npos ? inputs[i] : inputs[i].substr(slash + 1));
+    if (sameFile(inputs[i], item->target.file)) {
+      std::cerr << "Not overwriting source image: " << inputs[i]
+                << std::endl;
+      batch.status = 2;
+      continue;
+    }
+
+    {
+      StageTimer timer(batch.record, stage_decode);
+      if (MappedImage::formatOf(inputs[i]) >= 0) {
+        item->mapped.reset(new MappedImage(inputs[i]));
+        loaded = item->mapped->valid();
+        src    = item->mapped.get();
+      } else {
+        item->png.reset(new PNGImage(inputs[i]));
+        loaded = item->png->valid();
+        src    = item->png.get();
+        item->info.setInfo(*item->png);
+      }
+    }
+    if (!loaded) {
+      std::cerr << "Loading image \"" << inputs[i] << "\" failed."
+                << std::endl;
+      batch.status = 2;
+      continue;
+    }
+    if (batch.record)
+      batch.record->addBytesRead(fileSize(inputs[i]));
+    if (batch.dpi > 0)
+      item->info.setResolution(batch.dpi, batch.dpi);
+
+    completeSize(item->target, batch.keep_aspect,
+                 src->getWidth(), src->getHeight());
+    if (!decoded.push(std::move(item)))
+      break;
+  }
+  decoded.close();
+}
+
+// Second stage: resample, then let go of the source.
+static void
+resampleBatch (Batch& batch, BatchQueue& decoded, BatchQueue& resampled)
+{
+  std::unique_ptr<BatchItem> item;
+  while (decoded.pop(item)) {
+    const Image *src = item->png ? (const Image *) item->png.get() :
+                                   (const Image *) item->mapped.get();
+    std::vector<ResampleSize> sizes(1);
+    sizes[0].width  = item->target.xsize;
+    sizes[0].height = item->target.ysize;
+    // The curve is that of each source.
+    Resampler resampler(*batch.resampler);
+    if (batch.linear)
+      resampler.setLinearLight(linearLightOf(item->info));
+    item->dst = resampler.resampleImages(*src, sizes);
+    item->png.reset();
+    item->mapped.reset();
+    if (!resampled.push(std::move(item)))
+      break;
+  }
+  resampled.close();
+}
+
+// Resample inputs to files of the same names in the output directory, the
+// stages overlapping across files: decoding, resampling and encoding run
+// on threads of their own, the queues between them holding at most depth
+// images each. The pool is shared by the resampler and the encoder.
+// Returns the exit status, 2 if any file failed.
+static int
+runBatch (Batch& batch, const std::vector<std::string>& inputs, size_t depth,
+          std::vector<std::string>& outputs)
+{
+  BatchQueue decoded(depth), resampled(depth);
+
+  batch.status = 0;
+  std::thread decoding(decodeBatch, std::ref(batch), std::cref(inputs),
+                       std::ref(decoded));
+  std::thread resampling(resampleBatch, std::ref(batch), std::ref(decoded),
+                         std::ref(resampled));
+
+  std::unique_ptr<BatchItem> item;
+  while (resampled.pop(item)) {
+    int error;
+    {
+      StageTimer timer(batch.record, stage_encode);
+      error = saveImage(item->target.file, item->dst[0], item->info,
+                        batch.pool, batch.profile);
+    }
+    if (error) {
+      std::cerr << "Could not save destination image: "
+                << item->target.file << std::endl;
+      batch.status = 2;
+    } else {
+      if (batch.record)
+        batch.record->addBytesWritten(fileSize(item->target.file));
+      outputs.push_back(item->target.file);
+    }
+    item.reset();
+  }
+
+  decoding.join();
+  resampling.join();
+  return batch.status;
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -42,101 +559,306 @@ main (int argc, char *argv[])
   extern char *optarg;
   int32_t      xsize = 0, ysize = 0, dpi = 0;
   std::string  filter;
-  std::string  dstfile, srcfile;
+  std::string  srcfile;
+  std::vector<Target> targets, extra;
+  Target       target;
   bool         keep_aspect = false;
-  int          error = 0;
+  bool         stream = false;
+  int          threads = 1;
+  bool         fixed_point = true;
+  bool         linear = false;
+  bool         shrink = false;
+  int32_t      tile_size = 0, overlap = 1;
+  size_t       memory = 0;
+  std::string  record_file;
+  std::string  batch_dir;
+  size_t       depth = 2;
+  std::string  server;
+  int32_t      workers = 2;
+  enum png_profile_e profile = png_profile_balanced;
+  int64_t      wall = ResampleStats::wallClock();
+  int64_t      cpu  = ResampleStats::cpuClock();
 
   // process command line options.
   {
     int  c;
-    while ((c = getopt(argc, argv, "r:x:y:af:V")) != EOF) {
+    while ((c = getopt(argc, argv, "r:x:y:t:af:FeElj:sm:z:o:B:q:D:w:P:S:V")) != EOF) {
       switch(c) {
       case 'a': keep_aspect = true;   break;
       case 'r': dpi   = atoi(optarg); break;
       case 'x': xsize = atoi(optarg); break;
       case 'y': ysize = atoi(optarg); break;
+      case 't':
+        if (!parseTarget(optarg, target))
+          usage();
+        extra.push_back(target);
+        break;
+      case 's': stream = true;        break;
+      case 'F': fixed_point = false;  break;
+      case 'l': linear = true;        break;
+      case 'e': shrink = true;        break;
+      case 'E': shrink = false;       break;
+      case 'j': threads = atoi(optarg); break;
+      case 'm': memory = (size_t) atoi(optarg) << 20; break;
+      case 'z': tile_size = atoi(optarg); break;
+      case 'o': overlap = atoi(optarg); break;
+      case 'B': batch_dir = optarg;   break;
+      case 'D': server = optarg;      break;
+      case 'w': workers = atoi(optarg); break;
+      case 'q':
+        if (atoi(optarg) < 1)
+          usage();
+        depth = (size_t) atoi(optarg);
+        break;
+      case 'P':
+        if (PNGImage::profileOf(optarg) < 0)
+          usage();
+        profile = (enum png_profile_e) PNGImage::profileOf(optarg);
+        break;
+      case 'S': record_file = optarg; break;
       case 'f':
-        switch(*optarg) {
-        case 'b': filter = "Box"      ; break;
-        case 'l': filter = "Bilinear" ; break;
-        case 'B': filter = "B-Spline" ; break;
-        case 'c': filter = "Bicubic"  ; break;
-        case 'L': filter = "Lanczos3" ; break;
-        case 'm': filter = "Mitchell" ; break;
-        default: usage();
-        }
+        filter = filterName(*optarg);
+        if (filter.empty())
+          usage();
         break;
       case '?': usage();
       default:  usage();
       }
     }
   }
-  if((argc - optind) != 2)
+  if (!server.empty()) {
+    if (optind != argc || !extra.empty() || stream || memory > 0 ||
+        tile_size > 0 || !batch_dir.empty() || !record_file.empty())
+      usage();
+
+    // Jobs after the first find their buffers already faulted in.
+    BufferPool     buffers;
+    ImageAllocator::setDefault(&buffers);
+
+    ThreadPool     pool(threads);
+    ServerDefaults defaults = { filter, fixed_point, shrink, linear, dpi,
+                                profile, &pool };
+    ResampleServer daemon([&defaults](const std::string& request,
+                                      std::string& error) {
+      return runServerJob(request, defaults, error);
+    }, workers, depth);
+    daemon.setBufferPool(&buffers);
+
+    // Clients that leave before their reply are no reason to die.
+    signal(SIGPIPE, SIG_IGN);
+    int status = server == "-" ? daemon.serveStream(0, 1) :
+                                 daemon.serveSocket(server);
+    ImageAllocator::setDefault(NULL);
+    if (status != 0) {
+      std::cerr << "Could not serve " << server << std::endl;
+      return 2;
+    }
+    return 0;
+  }
+
+  if (!batch_dir.empty()) {
+    if (optind == argc || !extra.empty() || stream || memory > 0 ||
+        tile_size > 0)
+      usage();
+
+    BufferPool    buffers;
+    ImageAllocator::setDefault(&buffers);
+
+    ResampleStats stats;
+    ThreadPool    pool(threads);
+    Resampler     resampler(filter);
+    resampler.setThreadPool(&pool);
+    resampler.setFixedPoint(fixed_point);
+    resampler.setShrinkOnLoad(shrink);
+
+    Batch batch;
+    batch.outdir      = batch_dir;
+    batch.xsize       = xsize;
+    batch.ysize       = ysize;
+    batch.dpi         = dpi;
+    batch.keep_aspect = keep_aspect;
+    batch.linear      = linear;
+    batch.profile     = profile;
+    batch.resampler   = &resampler;
+    batch.pool        = &pool;
+    batch.record      = record_file.empty() ? NULL : &stats;
+    resampler.setStats(batch.record);
+
+    std::vector<std::string> inputs(argv + optind, argv + argc), outputs;
+    int status = runBatch(batch, inputs, depth, outputs);
+    ImageAllocator::setDefault(NULL);
+    if (batch.record &&
+        writeRecord(record_file, inputs, outputs, status, pool.getThreads(),
+                    ResampleStats::wallClock() - wall,
+                    ResampleStats::cpuClock() - cpu, &buffers, stats) != 0) {
+      std::cerr << "Could not write " << record_file << std::endl;
+      status = 2;
+    }
+    return status;
+  }
+
+  if ((argc - optind) == 2) {
+    target.xsize = xsize;
+    target.ysize = ysize;
+    target.file  = argv[optind + 1];
+    targets.push_back(target);
+  } else if ((argc - optind) != 1 || extra.empty())
     usage();
   srcfile = argv[optind];
-  dstfile = argv[optind + 1];
+  if (tile_size > 0 && (targets.size() != 1 || !extra.empty() || stream))
+    usage();
+  if (memory > 0 && (targets.size() != 1 || stream || tile_size > 0))
+    usage();
+  targets.insert(targets.end(), extra.begin(), extra.end());
 
-  PNGImage src(srcfile);
-  if (!src.valid()) {
-    std::cerr << "Loading PNG image \"" << srcfile << "\" failed." << std::endl;
-    exit(2);
+  ResampleStats  stats;
+  ResampleStats *record = record_file.empty() ? NULL : &stats;
+
+  // Only the header is read here; pixels are read on demand when
+  // streaming, or all at once below. Mapped files are read in place.
+  std::unique_ptr<PNGReader>   png;
+  std::unique_ptr<MappedImage> mapped;
+  std::unique_ptr<RowSource>   mappedRows;
+  RowSource *reader;
+  bool       loaded;
+  {
+    StageTimer timer(record, stage_decode);
+    if (MappedImage::formatOf(srcfile) >= 0) {
+      mapped.reset(new MappedImage(srcfile));
+      mappedRows.reset(new ImageRowSource(*mapped));
+      reader = mappedRows.get();
+      loaded = mapped->valid();
+    } else {
+      png.reset(new PNGReader(srcfile));
+      reader = png.get();
+      loaded = png->valid();
+    }
   }
-  if (xsize > 0 && ysize > 0) {
-    if (keep_aspect)
-      std::cerr << "Ignoring -a option." << std::endl;
-  } else if (keep_aspect) {
-    if (xsize == 0)
-      xsize = ysize * src.getWidth()  / src.getHeight();
-    if (ysize == 0)
-      ysize = xsize * src.getHeight() / src.getWidth();
+  stats.addBytesRead(fileSize(srcfile));
+  if (!loaded) {
+    std::cerr << "Loading image \"" << srcfile << "\" failed." << std::endl;
+    exit(2);
   }
-  if (xsize <= 0)
-    xsize = src.getWidth();
-  if (ysize <= 0)
-    ysize = src.getHeight();
+  for (size_t t = 0; t < targets.size(); t++)
+    completeSize(targets[t], keep_aspect,
+                 reader->getWidth(), reader->getHeight());
 
-  Resampler resampler(filter);
-  Image ras = resampler.resampleImage(src, xsize, ysize);
-  PNGImage dst(ras.getWidth(), ras.getHeight(),
-               ras.getNComps(), ras.getBPC(), ras.getPixelBytes());
+  // Colorspace and resolution are copied from a PNG source.
+  PNGInfo info;
+  if (png)
+    info.setInfo(*png);
   if (dpi > 0)
-    dst.setResolution(dpi, dpi);
-  else { // Copy resolution setting from source image.
-    dst.setResolution(src.getResolutionX(), src.getResolutionY());
+    info.setResolution(dpi, dpi);
+
+  // The whole source, unless it is streamed.
+  std::unique_ptr<PNGImage> decoded;
+  const Image *src = mapped.get();
+  if (png && !stream && memory == 0) {
+    StageTimer timer(record, stage_decode);
+    decoded.reset(new PNGImage(*png));
+    if (!decoded->valid()) {
+      std::cerr << "Loading image \"" << srcfile << "\" failed."
+                << std::endl;
+      exit(2);
+    }
+    src = decoded.get();
   }
-  // Copy colorspace related information
-  // There are currently no easy way to copy it.
-  {
-    enum png_colorspace_type_e type = src.getColorSpaceType();
-    dst.setColorSpaceType(type);
-    switch (type) {
-    case png_colorspace_iccp:
-      dst.setICCProfileName(src.getICCProfileName());
-      dst.setICCProfile(src.getICCProfile());
-      break;
-    case png_colorspace_srgb:
-      dst.setsRGBIntent(src.getsRGBIntent());
-      break;
-    case png_colorspace_calibrated:
+
+  ThreadPool pool(threads);
+  Resampler  resampler(filter);
+  resampler.setThreadPool(&pool);
+  resampler.setFixedPoint(fixed_point);
+  resampler.setShrinkOnLoad(shrink);
+  resampler.setStats(record);
+  if (linear)
+    resampler.setLinearLight(linearLightOf(info));
+  // Rows read and written while streaming are timed one at a time.
+  TimedRowSource timedReader(*reader, record);
+  // Every output comes from the one decoded source.
+  std::vector<int> error(targets.size(), 0);
+  if (tile_size > 0) {
+    TilePyramid pyramid(resampler, tile_size, overlap);
+    pyramid.setProfile(profile);
+    error[0] = pyramid.write(*src, targets[0].file, info);
+  } else if (memory > 0) {
+    std::unique_ptr<RowSink> writer;
+    {
+      StageTimer timer(record, stage_encode);
+      writer.reset(createWriter(targets[0], reader->getNComps(),
+                                reader->getBPC(), info, &pool, profile));
+    }
+    if (!writer)
+      error[0] = -1;
+    else {
+      TimedRowSink timedWriter(*writer, record);
+      if (resampler.resampleTiled(timedReader, timedWriter, targets[0].xsize,
+                                  targets[0].ysize, memory) != 0) {
+        std::cerr << "Resampling image \"" << srcfile << "\" failed."
+                  << std::endl;
+        exit(2);
+      }
+      error[0] = timedWriter.close();
+    }
+  } else if (stream) {
+    std::vector<std::unique_ptr<RowSink> > writers;
+    std::vector<std::unique_ptr<TimedRowSink> > timedWriters;
+    std::vector<ResampleSink> sinks;
+    for (size_t t = 0; t < targets.size(); t++) {
       {
-        std::vector<float> c = src.getChromaticity();
-        dst.setChromaticity(c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7]);
-        dst.setGamma(src.getGamma());
+        StageTimer timer(record, stage_encode);
+        writers.push_back(std::unique_ptr<RowSink>(createWriter(targets[t],
+            reader->getNComps(), reader->getBPC(), info, &pool, profile)));
       }
-      break;
-    case png_colorspace_gamma_only:
-      dst.setGamma(src.getGamma());
-      break;
-    case png_colorspace_device:
-      // do nothing
-      break;
+      if (!writers[t]) {
+        std::cerr << "Could not save destination image: "
+                  << targets[t].file << std::endl;
+        exit(2);
+      }
+      timedWriters.push_back(std::unique_ptr<TimedRowSink>(
+          new TimedRowSink(*writers[t], record)));
+      ResampleSink sink = { timedWriters[t].get(),
+                            targets[t].xsize, targets[t].ysize };
+      sinks.push_back(sink);
+    }
+    if (resampler.resampleStream(timedReader, sinks) != 0) {
+      std::cerr << "Resampling image \"" << srcfile << "\" failed."
+                << std::endl;
+      exit(2);
+    }
+    for (size_t t = 0; t < targets.size(); t++)
+      error[t] = timedWriters[t]->close();
+  } else {
+    std::vector<ResampleSize> sizes;
+    for (size_t t = 0; t < targets.size(); t++) {
+      ResampleSize size = { targets[t].xsize, targets[t].ysize };
+      sizes.push_back(size);
+    }
+    std::vector<Image> dst = resampler.resampleImages(*src, sizes);
+    for (size_t t = 0; t < targets.size(); t++) {
+      StageTimer timer(record, stage_encode);
+      error[t] = saveImage(targets[t].file, dst[t], info, &pool, profile);
     }
   }
-  error = dst.save(dstfile);
-  if (error) {
-    std::cerr << "Could not save destination image: " << dstfile << std::endl;
-    exit(2);
+  int status = 0;
+  for (size_t t = 0; t < targets.size(); t++) {
+    if (error[t]) {
+      std::cerr << "Could not save destination image: "
+                << targets[t].file << std::endl;
+      status = 2;
+    } else if (tile_size == 0)
+      stats.addBytesWritten(fileSize(targets[t].file));
   }
 
-  return 0;
+  std::vector<std::string> inputs(1, srcfile), outputs;
+  for (size_t t = 0; t < targets.size(); t++)
+    outputs.push_back(targets[t].file);
+  if (record &&
+      writeRecord(record_file, inputs, outputs, status, pool.getThreads(),
+                  ResampleStats::wallClock() - wall,
+                  ResampleStats::cpuClock() - cpu, NULL, stats) != 0) {
+    std::cerr << "Could not write " << record_file << std::endl;
+    status = 2;
+  }
+
+  return status;
 }